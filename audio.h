@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu.h"
+
+// Converts interleaved signed integer samples, as DeckLink captures them, into
+// planar float in [-1, 1), as NDI sends them. dst holds one run of frames
+// samples per channel, stride floats apart.
+
+namespace audio {
+
+template <typename Sample>
+using Deinterleave = void (*)(Sample const *src, float *dst, std::size_t stride,
+                              int channels, long frames);
+
+template <typename Sample>
+constexpr float scale = 1.0f / (1u << (8 * sizeof(Sample) - 1));
+
+template <typename Sample>
+inline void DeinterleaveScalar(Sample const *src, float *dst,
+                               std::size_t stride, int channels, long frames) {
+  for (auto c = 0; c < channels; c++) {
+    auto const out = dst + c * stride;
+    for (auto i = 0l; i < frames; i++) {
+      out[i] = static_cast<float>(src[i * channels + c]) * scale<Sample>;
+    }
+  }
+}
+
+#if defined(X86)
+TARGET("avx2")
+inline auto Load8(std::int32_t const *src) {
+  return _mm256_cvtepi32_ps(
+      _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src)));
+}
+
+TARGET("avx2")
+inline auto Load8(std::int16_t const *src) {
+  return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+      _mm_loadu_si128(reinterpret_cast<__m128i const *>(src))));
+}
+
+// Eight frames of eight channels in, eight channels of eight frames out
+TARGET("avx2")
+inline void Transpose8(__m256 (&rows)[8]) {
+  auto const t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+  auto const t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+  auto const t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+  auto const t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+  auto const t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+  auto const t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+  auto const t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+  auto const t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+  auto const u0 = _mm256_shuffle_ps(t0, t2, 0x44);
+  auto const u1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+  auto const u2 = _mm256_shuffle_ps(t1, t3, 0x44);
+  auto const u3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+  auto const u4 = _mm256_shuffle_ps(t4, t6, 0x44);
+  auto const u5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+  auto const u6 = _mm256_shuffle_ps(t5, t7, 0x44);
+  auto const u7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+  rows[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+  rows[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+  rows[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+  rows[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+  rows[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+  rows[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+  rows[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+  rows[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+template <typename Sample>
+TARGET("avx2")
+void DeinterleaveAvx2(Sample const *src, float *dst, std::size_t stride,
+                      int channels, long frames) {
+  auto const scale = _mm256_set1_ps(audio::scale<Sample>);
+  auto i = 0l;
+  if (channels == 2) {
+    auto const split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    for (; i + 8 <= frames; i += 8) {
+      auto const v0 = _mm256_permutevar8x32_ps(
+          _mm256_mul_ps(Load8(src + 2 * i), scale), split);
+      auto const v1 = _mm256_permutevar8x32_ps(
+          _mm256_mul_ps(Load8(src + 2 * i + 8), scale), split);
+      _mm256_storeu_ps(dst + i, _mm256_permute2f128_ps(v0, v1, 0x20));
+      _mm256_storeu_ps(dst + stride + i,
+                       _mm256_permute2f128_ps(v0, v1, 0x31));
+    }
+  } else if (channels % 8 == 0) {
+    for (; i + 8 <= frames; i += 8) {
+      for (auto c = 0; c < channels; c += 8) {
+        __m256 rows[8];
+        for (auto j = 0; j < 8; j++) {
+          rows[j] = _mm256_mul_ps(Load8(src + (i + j) * channels + c), scale);
+        }
+        Transpose8(rows);
+        for (auto j = 0; j < 8; j++) {
+          _mm256_storeu_ps(dst + (c + j) * stride + i, rows[j]);
+        }
+      }
+    }
+  }
+  DeinterleaveScalar(src + i * channels, dst + i, stride, channels,
+                     frames - i);
+}
+#endif
+
+template <typename Sample> inline auto Best() -> Deinterleave<Sample> {
+#if defined(X86)
+  if (CpuHasAvx2()) {
+    return DeinterleaveAvx2<Sample>;
+  }
+#endif
+  return DeinterleaveScalar<Sample>;
+}
+
+template <typename Sample>
+inline Deinterleave<Sample> const BestDeinterleave = Best<Sample>();
+
+} // namespace audio
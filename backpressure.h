@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "counters.h"
+#include "frame_descriptor.h"
+#include "frame_ring.h"
+#include "options.h"
+
+// Applies a sink's drop policy to the frames the capture thread offers it.
+//
+// Drop newest turns frames away while the ring is full, keeping those already
+// queued. Drop oldest lets the ring take twice its depth and has the sink skip
+// whatever has fallen behind the newest depth - 1 frames, so it catches up on
+// the freshest ones with no more waiting than drop newest. Block waits a while
+// for room, holding up the driver, whose own queue --flush-backlog can clear.
+// Halve sends every other frame once the ring has stayed at least half full
+// for a while, until it has stayed empty for longer.
+//
+// Audio is never dropped by choice, a skipped frame's audio is queued on its
+// own.
+class Backpressure {
+private:
+  // Frames in a row that make an overload sustained, and that show it is over
+  static constexpr auto overloadFrames = 25;
+  static constexpr auto recoveryFrames = 100;
+
+  std::string name;
+  DropPolicy policy;
+  std::chrono::milliseconds timeout;
+
+  // Only touched by the capture thread
+  bool halving = false;
+  bool skipped = false;
+  int streak = 0;
+
+  // Whether to queue this frame at all, only false while halving
+  auto admit(FrameRing const &ring) -> bool {
+    if (policy != DropPolicy::Halve) {
+      return true;
+    }
+    auto const queued = ring.queued();
+    if (!halving) {
+      streak = queued * 2 >= ring.depth() ? streak + 1 : 0;
+      if (streak == overloadFrames) {
+        halving = true;
+        streak = 0;
+        std::cout << name << ": falling behind, halving the frame rate\n";
+      }
+      return true;
+    }
+    streak = queued == 0 ? streak + 1 : 0;
+    if (streak == recoveryFrames) {
+      halving = false;
+      streak = 0;
+      std::cout << name << ": caught up, back to the full frame rate\n";
+      return true;
+    }
+    skipped = !skipped;
+    return !skipped;
+  }
+
+  // Waits for room under block, false if there is still none
+  auto wait(FrameRing &ring) const -> bool {
+    if (policy != DropPolicy::Block || ring.hasRoom()) {
+      return true;
+    }
+    return ring.waitForRoom(std::chrono::steady_clock::now() + timeout);
+  }
+
+public:
+  Backpressure(std::string name, DropPolicy policy,
+               std::chrono::milliseconds timeout)
+      : name{std::move(name)}, policy{policy}, timeout{timeout} {}
+
+  // The ring capacity the policy needs for a sink of this depth
+  static auto Capacity(DropPolicy policy, std::size_t depth) -> std::size_t {
+    return policy == DropPolicy::Oldest ? 2 * depth : depth;
+  }
+
+  // When the ring should mark frames stale, see FrameRing. Only drop oldest
+  // skips frames, from depth - 1 behind, where a full ring under drop newest
+  // keeps depth - 1 waiting beside the one NDI holds. Under the others a full
+  // ring with nothing held is depth frames, every one of them to be sent.
+  static auto StaleAt(DropPolicy policy, std::size_t depth) -> std::size_t {
+    return policy == DropPolicy::Oldest
+               ? depth
+               : std::numeric_limits<std::size_t>::max();
+  }
+
+  // Queues whatever of the frame and audio the policy lets through, counting
+  // whichever of them is not queued in drops. True if the video frame was.
+  auto push(FrameRing &ring, DropCounters &drops, FrameHandle frame,
+            AudioHandle audio, FrameDescriptor const *descriptor,
+            std::int64_t frameTimecode, std::int64_t audioTimecode,
+            std::chrono::steady_clock::time_point arrivedAt) -> bool {
+    if (frame != nullptr && !admit(ring)) {
+      drops.halved.add();
+      frame.reset();
+      if (audio == nullptr) {
+        return false;
+      }
+    }
+    auto const room = wait(ring);
+    auto const video = frame != nullptr;
+    auto const hasAudio = audio != nullptr;
+    if (room && ring.push(std::move(frame), std::move(audio), descriptor,
+                          frameTimecode, audioTimecode, arrivedAt)) {
+      return video;
+    }
+    if (video) {
+      (room ? drops.overflows : drops.timeouts).add();
+    }
+    if (hasAudio) {
+      drops.audio.add();
+    }
+    return false;
+  }
+};
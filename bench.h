@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "counters.h"
+#include "cpu.h"
+#include "histogram.h"
+
+// --bench runs for this long before measuring, so buffer pools are full and
+// the clocks have locked
+inline constexpr auto benchWarmup = std::chrono::seconds{2};
+
+// One stream at one moment, empty while its device is away
+struct BenchSample {
+  StreamStats stats{};
+  Histogram::Snapshot latency;
+};
+
+// Every stream at one moment. The report is the difference between two.
+struct BenchPoint {
+  std::chrono::steady_clock::time_point at = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds processCpu = ProcessCpuTime();
+  std::vector<BenchSample> streams;
+};
+
+struct BenchStream {
+  std::string name;
+  std::string mode;
+  std::uint64_t captured;
+  std::uint64_t sent;
+  // Overflowing the ring, missed by the driver or flushed from its backlog
+  std::uint64_t dropped;
+  double framesPerSecond;
+  // Of one core, for the threads the stream has to itself
+  double cpuPercent;
+  // Capture to submit, in microseconds
+  double p50;
+  double p99;
+  double p999;
+  double max;
+};
+
+struct BenchReport {
+  double seconds;
+  std::string pixelFormat;
+  // Of one core, for the whole process, NDI's own threads included
+  double processCpuPercent;
+  std::vector<BenchStream> streams;
+};
+
+// names and modes are in the same order as the samples
+inline auto MakeBenchReport(std::vector<std::string> const &names,
+                            std::vector<std::string> const &modes,
+                            std::string pixelFormat, BenchPoint const &start,
+                            BenchPoint const &end) -> BenchReport {
+  auto const seconds = std::chrono::duration<double>{end.at - start.at}.count();
+  auto const percent = [&](std::uint64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) / 1e9 / seconds * 100;
+  };
+  auto report = BenchReport{
+      seconds, std::move(pixelFormat),
+      percent(static_cast<std::uint64_t>((end.processCpu - start.processCpu)
+                                             .count())),
+      {}};
+  for (auto i = std::size_t{0}; i < names.size(); i++) {
+    auto const &a = start.streams[i].stats;
+    auto const &b = end.streams[i].stats;
+    auto const latency = end.streams[i].latency - start.streams[i].latency;
+    auto const us = [&](double q) {
+      return static_cast<double>(latency.percentile(q)) / 1000;
+    };
+    // A stream's counters start again from zero when its device comes back,
+    // so they may have gone down since the start
+    auto const since = [](std::uint64_t start, std::uint64_t end) {
+      return end - std::min(start, end);
+    };
+    auto const sent = since(a.sent, b.sent);
+    report.streams.push_back({
+        names[i],
+        modes[i],
+        since(a.captured, b.captured),
+        sent,
+        since(a.drops.total(), b.drops.total()) + since(a.missed, b.missed) +
+            since(a.flushed, b.flushed),
+        static_cast<double>(sent) / seconds,
+        percent(since(a.cpuTime, b.cpuTime)),
+        us(0.5),
+        us(0.99),
+        us(0.999),
+        static_cast<double>(latency.max()) / 1000,
+    });
+  }
+  return report;
+}
+
+inline auto operator<<(std::ostream &os, BenchReport const &report)
+    -> std::ostream & {
+  auto const flags = os.flags();
+  auto const precision = os.precision();
+  os << std::fixed << std::setprecision(1) << "Benchmark of " << report.seconds
+     << "s capturing " << report.pixelFormat << ", "
+     << report.processCpuPercent << "% CPU in all\n";
+  for (auto const &s : report.streams) {
+    os << s.name << " (" << s.mode << "): " << s.framesPerSecond
+       << " frames/s, " << s.sent << " sent of " << s.captured
+       << " captured, " << s.dropped << " dropped, " << s.cpuPercent
+       << "% CPU, capture to submit p50 " << s.p50 << "us p99 " << s.p99
+       << "us p99.9 " << s.p999 << "us max " << s.max << "us\n";
+  }
+  os.flags(flags);
+  os.precision(precision);
+  return os;
+}
+
+inline void WriteJsonString(std::ostream &os, std::string_view s) {
+  os << '"';
+  for (auto const c : s) {
+    switch (c) {
+    case '"':
+      os << "\\\"";
+      break;
+    case '\\':
+      os << "\\\\";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        auto const flags = os.flags();
+        os << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+           << static_cast<int>(c);
+        os.flags(flags);
+      } else {
+        os << c;
+      }
+    }
+  }
+  os << '"';
+}
+
+inline void WriteJson(std::ostream &os, BenchReport const &report) {
+  // Three places whatever the stream was left with
+  auto const flags = os.flags();
+  auto const precision = os.precision();
+  os << std::fixed << std::setprecision(3);
+  os << "{\n  \"seconds\": " << report.seconds << ",\n  \"pixelFormat\": ";
+  WriteJsonString(os, report.pixelFormat);
+  os << ",\n  \"processCpuPercent\": " << report.processCpuPercent
+     << ",\n  \"streams\": [";
+  auto first = true;
+  for (auto const &s : report.streams) {
+    os << (first ? "\n" : ",\n") << "    {\"name\": ";
+    first = false;
+    WriteJsonString(os, s.name);
+    os << ", \"mode\": ";
+    WriteJsonString(os, s.mode);
+    os << ", \"captured\": " << s.captured << ", \"sent\": " << s.sent
+       << ", \"dropped\": " << s.dropped
+       << ", \"framesPerSecond\": " << s.framesPerSecond
+       << ", \"cpuPercent\": " << s.cpuPercent
+       << ", \"latencyUs\": {\"p50\": " << s.p50 << ", \"p99\": " << s.p99
+       << ", \"p99.9\": " << s.p999 << ", \"max\": " << s.max << "}}";
+  }
+  os << "\n  ]\n}\n";
+  os.flags(flags);
+  os.precision(precision);
+}
@@ -0,0 +1,103 @@
+// Checks what each drop policy sends of a burst that fills a sink's ring, with
+// NDI holding nothing (at startup, or after an idle or backlog flush) and with
+// NDI holding the frame sent last. Only drop oldest may skip frames it
+// admitted. Then times a frame's round trip through the ring with the sender
+// keeping up.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+#include "../backpressure.h"
+#include "../counters.h"
+#include "../fake_decklink.h"
+#include "../frame_ring.h"
+
+constexpr auto depth = std::size_t{4};
+constexpr auto burst = 3 * depth;
+constexpr auto iterations = 1'000'000;
+
+// A two pixel frame, as the ring never looks inside
+auto MakeFrame() {
+  auto const frame = DeckLinkPtr<fake::VideoFrame>{new fake::VideoFrame{
+      nullptr, std::malloc(4), 2, 1, bmdFormat8BitYUV, 0, 1, 25, {}}};
+  return FrameHandle{frame.get()};
+}
+
+struct Outcome {
+  std::uint64_t admitted = 0;
+  std::uint64_t sent = 0;
+  DropStats drops;
+};
+
+// Sends everything queued as the sender would, skipping stale frames
+void Drain(FrameRing &ring, DropCounters &drops, Outcome &outcome) {
+  while (auto const pending = ring.pending()) {
+    if (pending.stale) {
+      drops.stale.add();
+      ring.drop();
+      continue;
+    }
+    outcome.sent++;
+    ring.submit();
+  }
+}
+
+auto Burst(DropPolicy policy, bool held) -> Outcome {
+  auto ring = FrameRing{depth, Backpressure::Capacity(policy, depth),
+                        Backpressure::StaleAt(policy, depth)};
+  auto backpressure =
+      Backpressure{"bench", policy, std::chrono::milliseconds{1}};
+  auto drops = DropCounters{};
+  auto outcome = Outcome{};
+  if (held) {
+    ring.push(MakeFrame(), {}, nullptr, 0, 0, {});
+    ring.pending();
+    ring.submit();
+  }
+  for (auto i = std::size_t{0}; i < burst; i++) {
+    if (backpressure.push(ring, drops, MakeFrame(), {}, nullptr, 0, 0, {})) {
+      outcome.admitted++;
+    }
+  }
+  Drain(ring, drops, outcome);
+  ring.flush();
+  outcome.drops = drops.load();
+  return outcome;
+}
+
+void Report(std::string_view name, DropPolicy policy) {
+  for (auto const held : {false, true}) {
+    auto const outcome = Burst(policy, held);
+    auto const lost = policy != DropPolicy::Oldest &&
+                      outcome.sent != outcome.admitted;
+    std::cout << name << (held ? ", one frame held" : ", nothing held")
+              << ": " << outcome.admitted << " of " << burst
+              << " admitted, " << outcome.sent << " sent, "
+              << outcome.drops.stale << " stale"
+              << (lost ? ", ADMITTED FRAMES NOT SENT" : "") << '\n';
+  }
+}
+
+int main() {
+  Report("newest", DropPolicy::Newest);
+  Report("oldest", DropPolicy::Oldest);
+  Report("block", DropPolicy::Block);
+  Report("halve", DropPolicy::Halve);
+
+  auto ring = FrameRing{depth, depth};
+  auto const frame = MakeFrame();
+  auto const start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < iterations; i++) {
+    ring.push(frame, {}, nullptr, 0, 0, {});
+    ring.pending();
+    ring.submit();
+  }
+  auto const elapsed = std::chrono::duration<double, std::nano>{
+      std::chrono::steady_clock::now() - start};
+  ring.flush();
+  std::cout << "push, pending and submit: " << elapsed.count() / iterations
+            << "ns a frame\n";
+}
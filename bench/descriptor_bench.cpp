@@ -0,0 +1,147 @@
+// Per frame cost of building the NDI frame, querying the display mode on
+// every frame as the sender used to, against reading a FrameDescriptor
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+#include "../frame_descriptor.h"
+
+constexpr auto iterations = 10'000'000;
+
+class FakeDisplayMode : public IDeckLinkDisplayMode {
+public:
+  auto GetName(decltype(DLString::data) *) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetDisplayMode() -> BMDDisplayMode override { return bmdModeHD1080i50; }
+  auto GetWidth() -> long override { return 1920; }
+  auto GetHeight() -> long override { return 1080; }
+  auto GetFrameRate(BMDTimeValue *frameDuration, BMDTimeScale *timeScale)
+      -> HRESULT override {
+    *frameDuration = 1000;
+    *timeScale = 25000;
+    return S_OK;
+  }
+  auto GetFieldDominance() -> BMDFieldDominance override {
+    return bmdUpperFieldFirst;
+  }
+  auto GetFlags() -> BMDDisplayModeFlags override { return 0; }
+
+  auto QueryInterface(REFIID, LPVOID *) -> HRESULT override {
+    return E_NOINTERFACE;
+  }
+  auto AddRef() -> ULONG override { return 1; }
+  auto Release() -> ULONG override { return 1; }
+};
+
+class FakeFrame : public IDeckLinkVideoInputFrame {
+private:
+  std::uint8_t data[64];
+
+public:
+  auto GetWidth() -> long override { return 1920; }
+  auto GetHeight() -> long override { return 1080; }
+  auto GetRowBytes() -> long override { return 3840; }
+  auto GetPixelFormat() -> BMDPixelFormat override { return bmdFormat8BitYUV; }
+  auto GetFlags() -> BMDFrameFlags override { return bmdFrameFlagDefault; }
+  auto GetBytes(void **buffer) -> HRESULT override {
+    *buffer = data;
+    return S_OK;
+  }
+  auto GetTimecode(BMDTimecodeFormat, IDeckLinkTimecode **) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetAncillaryData(IDeckLinkVideoFrameAncillary **) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetStreamTime(BMDTimeValue *, BMDTimeValue *, BMDTimeScale)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+  auto GetHardwareReferenceTimestamp(BMDTimeScale, BMDTimeValue *,
+                                     BMDTimeValue *) -> HRESULT override {
+    return E_NOTIMPL;
+  }
+
+  auto QueryInterface(REFIID, LPVOID *) -> HRESULT override {
+    return E_NOINTERFACE;
+  }
+  auto AddRef() -> ULONG override { return 1; }
+  auto Release() -> ULONG override { return 1; }
+};
+
+// Read through volatile pointers so the calls stay virtual
+auto fakeDisplayMode = FakeDisplayMode{};
+auto fakeFrame = FakeFrame{};
+IDeckLinkDisplayMode *volatile displayModePtr = &fakeDisplayMode;
+IDeckLinkVideoInputFrame *volatile framePtr = &fakeFrame;
+
+void Consume(NDIlib_video_frame_v2_t const &frame) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r"(&frame) : "memory");
+#else
+  static NDIlib_video_frame_v2_t volatile sink;
+  sink.p_data = frame.p_data;
+#endif
+}
+
+auto PerFrameQueries() {
+  auto const bmd_frame = framePtr;
+  auto const displayMode = displayModePtr;
+
+  void *data;
+  bmd_frame->GetBytes(&data);
+
+  BMDTimeValue fps_value;
+  BMDTimeScale fps_scale;
+  displayMode->GetFrameRate(&fps_value, &fps_scale);
+
+  auto format = [&] {
+    switch (displayMode->GetFieldDominance()) {
+      case bmdUpperFieldFirst:
+        return NDIlib_frame_format_type_interleaved;
+      case bmdProgressiveFrame:
+        return NDIlib_frame_format_type_progressive;
+      case bmdProgressiveSegmentedFrame:
+        return NDIlib_frame_format_type_interleaved;
+      default:
+        std::terminate();
+    }
+  }();
+
+  return NDIlib_video_frame_v2_t(
+      bmd_frame->GetWidth(), bmd_frame->GetHeight(), NDIlib_FourCC_type_UYVY,
+      static_cast<int>(fps_scale), static_cast<int>(fps_value), 0.0f, format,
+      0, static_cast<uint8_t *>(data), bmd_frame->GetRowBytes());
+}
+
+auto descriptors = FrameDescriptors{};
+
+auto Descriptor() {
+  auto const bmd_frame = framePtr;
+  auto const descriptor = descriptors.get();
+
+  void *data;
+  bmd_frame->GetBytes(&data);
+
+  return MakeNdiFrame(*descriptor, data, 0);
+}
+
+auto time(char const *name, auto const &makeFrame) {
+  auto const start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < iterations; i++) {
+    Consume(makeFrame());
+  }
+  auto const perFrame = std::chrono::duration<double, std::nano>{
+                            std::chrono::steady_clock::now() - start} /
+                        iterations;
+  std::cout << name << ": " << perFrame.count() << "ns per frame\n";
+}
+
+int main() {
+  descriptors.select(displayModePtr, bmdFormat8BitYUV);
+
+  time("Display mode queries", PerFrameQueries);
+  time("Frame descriptor", Descriptor);
+}
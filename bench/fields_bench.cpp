@@ -0,0 +1,77 @@
+// Times fields::ShiftDown on NTSC frames and checks it against moving the
+// frame down a line with a single memcpy, for row sizes with and without a 16
+// byte tail and a destination off 16 byte alignment.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string_view>
+
+#include "../buffer_pool.h"
+#include "../fields.h"
+
+constexpr auto height = 486l;
+constexpr auto iterations = 1000;
+constexpr auto frameTime =
+    std::chrono::duration<double, std::milli>{1001.0 / 30};
+
+auto time(auto const &run) {
+  auto best = std::chrono::duration<double, std::milli>::max();
+  auto total = std::chrono::duration<double, std::milli>{};
+  for (auto i = 0; i < iterations; i++) {
+    auto const start = std::chrono::steady_clock::now();
+    run();
+    auto const elapsed = std::chrono::duration<double, std::milli>{
+        std::chrono::steady_clock::now() - start};
+    best = std::min(best, elapsed);
+    total += elapsed;
+  }
+  return std::pair{best, total / iterations};
+}
+
+void report(std::string_view name, auto const &times, bool matches) {
+  auto const [best, mean] = times;
+  std::cout << name << ": best " << best.count() << "ms, mean " << mean.count()
+            << "ms, " << 100 * mean / frameTime << "% of an NTSC frame"
+            << (matches ? "" : ", OUTPUT DIFFERS") << '\n';
+}
+
+// dst is offset bytes, less than 16, into its buffer to take it off 16 byte
+// alignment
+void Run(std::string_view name, BufferPool &pool, long rowBytes,
+         std::size_t offset) {
+  auto const size = static_cast<std::size_t>(rowBytes * height);
+  // Every buffer the same size, so the pool keeps them all
+  auto const src = Acquire(pool, size + 16);
+  auto const expectedBuffer = Acquire(pool, size + 16);
+  auto const dstBuffer = Acquire(pool, size + 16);
+  auto const from = static_cast<std::uint8_t *>(src.get());
+  auto const expected = static_cast<std::uint8_t *>(expectedBuffer.get());
+  auto const dst = static_cast<std::uint8_t *>(dstBuffer.get()) + offset;
+
+  auto random = std::mt19937{};
+  std::generate(from, from + size, [&] { return random(); });
+  // The first line of the lower field, then every line one further down
+  std::memcpy(expected, from + rowBytes, static_cast<std::size_t>(rowBytes));
+  std::memcpy(expected + rowBytes, from,
+              static_cast<std::size_t>(rowBytes * (height - 1)));
+
+  std::fill(dst, dst + size, 0);
+  auto const times =
+      time([&] { fields::ShiftDown(from, dst, rowBytes, height); });
+  report(name, times, std::memcmp(dst, expected, size) == 0);
+
+  auto const memcpyTimes = time([&] { std::memcpy(dst, from, size); });
+  report("  memcpy of the whole frame", memcpyTimes, true);
+}
+
+int main() {
+  auto pool = BufferPool{false};
+  Run("UYVY, 1440 byte rows", pool, 1440, 0);
+  Run("v210, 1920 byte rows", pool, 1920, 0);
+  Run("UYVY, unaligned", pool, 1440, 8);
+  Run("1442 byte rows", pool, 1442, 0);
+}
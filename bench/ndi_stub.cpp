@@ -0,0 +1,514 @@
+// A stand-in for the NDI runtime, so the whole pipeline can be run and
+// measured on a machine with no NDI install or network. Senders keep to the
+// real library's contract as far as a caller can tell: an async frame is read
+// by a worker thread and handed back on the next send, and video and audio
+// are clocked when asked. Each sender's call timings and frame sizes are
+// printed when it is destroyed, along with any frame written to while the
+// library still owned it.
+//
+// Built with the benchmarks, point NDI_RUNTIME_DIR_V5 at the build directory
+// to use it. Set in the environment:
+//   NDI_STUB_CONNECTIONS  Receivers every sender reports (default 1)
+//   NDI_STUB_TALLY        program, preview or both (default neither)
+//   NDI_STUB_BURN_US      CPU to burn per video frame, as compression would
+//   NDI_STUB_SOURCE       WxH of the grey UYVY frame every frame sync returns,
+//                         by default they return no frame
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Processing.NDI.Lib.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+auto EnvNumber(char const *name, long fallback) -> long {
+  auto const value = std::getenv(name);
+  return value != nullptr ? std::strtol(value, nullptr, 10) : fallback;
+}
+
+struct Settings {
+  int connections = static_cast<int>(EnvNumber("NDI_STUB_CONNECTIONS", 1));
+  NDIlib_tally_t tally = [] {
+    auto const value = std::getenv("NDI_STUB_TALLY");
+    auto const tally = std::string{value != nullptr ? value : ""};
+    return NDIlib_tally_t{tally == "program" || tally == "both",
+                          tally == "preview" || tally == "both"};
+  }();
+  std::chrono::microseconds burn{EnvNumber("NDI_STUB_BURN_US", 0)};
+  int sourceWidth = 0;
+  int sourceHeight = 0;
+
+  Settings() {
+    if (auto const source = std::getenv("NDI_STUB_SOURCE")) {
+      std::sscanf(source, "%dx%d", &sourceWidth, &sourceHeight);
+    }
+  }
+};
+
+auto settings() -> Settings const & {
+  static auto const s = Settings{};
+  return s;
+}
+
+struct Timing {
+  std::uint64_t count = 0;
+  Clock::duration total{};
+  Clock::duration max{};
+
+  void add(Clock::duration d) {
+    count++;
+    total += d;
+    max = std::max(max, d);
+  }
+};
+
+auto operator<<(std::ostream &os, Timing const &t) -> std::ostream & {
+  using us = std::chrono::duration<double, std::micro>;
+  auto const mean = t.count > 0 ? us{t.total}.count() / t.count : 0.0;
+  return os << t.count << " calls, mean " << mean << "us, max "
+            << us{t.max}.count() << "us";
+}
+
+auto FrameBytes(NDIlib_video_frame_v2_t const &video) -> std::size_t {
+  auto const plane =
+      static_cast<std::size_t>(video.line_stride_in_bytes) * video.yres;
+  switch (video.FourCC) {
+  case NDIlib_FourCC_type_P216:
+  case NDIlib_FourCC_type_UYVA:
+    return plane * 2;
+  case NDIlib_FourCC_type_NV12:
+  case NDIlib_FourCC_type_I420:
+  case NDIlib_FourCC_type_YV12:
+    return plane * 3 / 2;
+  default:
+    return plane;
+  }
+}
+
+// A sample of the frame, to notice it being written while we own it
+auto Fingerprint(std::uint8_t const *data, std::size_t size) -> std::uint64_t {
+  auto hash = std::uint64_t{14695981039346656037u};
+  for (auto i = std::size_t{0}; i < size; i += 4093) {
+    hash = (hash ^ data[i]) * 1099511628211u;
+  }
+  return hash;
+}
+
+void Burn(Clock::duration d) {
+  auto const until = Clock::now() + d;
+  while (Clock::now() < until) {
+  }
+}
+
+class Sender {
+private:
+  std::string name;
+  bool clockVideo;
+  bool clockAudio;
+  NDIlib_source_t source;
+
+  // The async frame the worker has, and the caller must not touch until the
+  // next send
+  std::mutex mutex;
+  std::condition_variable condition;
+  NDIlib_video_frame_v2_t held{};
+  std::size_t heldBytes = 0;
+  std::uint64_t heldFingerprint = 0;
+  bool working = false;
+  bool holding = false;
+  bool quit = false;
+  std::thread worker;
+
+  Clock::time_point nextVideo{};
+  Clock::time_point nextAudio{};
+
+  // Send calls all come from one thread, the rest may not
+  std::mutex statsMutex;
+  Timing videoCalls;
+  Timing audioCalls;
+  Timing compression;
+  std::uint64_t asyncFrames = 0;
+  std::uint64_t syncFrames = 0;
+  std::uint64_t flushes = 0;
+  std::uint64_t videoBytes = 0;
+  std::uint64_t audioSamples = 0;
+  std::uint64_t metadataFrames = 0;
+  std::uint64_t overwritten = 0;
+  std::uint64_t connectionQueries = 0;
+  std::uint64_t tallyQueries = 0;
+
+  // Reads the frame through, as compression would, then burns the rest of
+  // its CPU budget
+  auto compress(NDIlib_video_frame_v2_t const &video, std::size_t bytes)
+      -> Clock::duration {
+    auto const start = Clock::now();
+    auto sum = std::uint64_t{0};
+    for (auto i = std::size_t{0}; i + 8 <= bytes; i += 64) {
+      auto word = std::uint64_t{};
+      std::memcpy(&word, video.p_data + i, 8);
+      sum += word;
+    }
+    [[maybe_unused]] auto volatile sink = sum;
+    Burn(settings().burn - (Clock::now() - start));
+    return Clock::now() - start;
+  }
+
+  void work() {
+    auto lock = std::unique_lock{mutex};
+    while (true) {
+      condition.wait(lock, [&] { return quit || working; });
+      if (quit) {
+        return;
+      }
+      auto const video = held;
+      auto const bytes = heldBytes;
+      lock.unlock();
+      auto const took = compress(video, bytes);
+      {
+        auto const stats = std::scoped_lock{statsMutex};
+        compression.add(took);
+      }
+      lock.lock();
+      working = false;
+      condition.notify_all();
+    }
+  }
+
+  // Waits for the held frame to be finished with and hands it back
+  void release() {
+    auto lock = std::unique_lock{mutex};
+    condition.wait(lock, [&] { return !working; });
+    if (holding) {
+      holding = false;
+      if (Fingerprint(held.p_data, heldBytes) != heldFingerprint) {
+        auto const stats = std::scoped_lock{statsMutex};
+        overwritten++;
+      }
+    }
+  }
+
+  static void pace(Clock::time_point &next, Clock::duration period) {
+    auto const now = Clock::now();
+    if (next < now - period) {
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+    next += period;
+  }
+
+  void paceVideo(NDIlib_video_frame_v2_t const &video) {
+    if (clockVideo && video.frame_rate_N > 0) {
+      pace(nextVideo, std::chrono::duration_cast<Clock::duration>(
+                          std::chrono::duration<double>{
+                              static_cast<double>(video.frame_rate_D) /
+                              video.frame_rate_N}));
+    }
+  }
+
+public:
+  explicit Sender(NDIlib_send_create_t const &create)
+      : name{create.p_ndi_name != nullptr ? create.p_ndi_name : "stub"},
+        clockVideo{create.clock_video}, clockAudio{create.clock_audio},
+        source{name.c_str()} {
+    worker = std::thread{[this] { work(); }};
+  }
+
+  Sender(Sender const &) = delete;
+  Sender &operator=(Sender const &) = delete;
+
+  ~Sender() {
+    release();
+    {
+      auto const lock = std::scoped_lock{mutex};
+      quit = true;
+    }
+    condition.notify_all();
+    worker.join();
+
+    std::cerr << "ndi stub: " << name << '\n'
+              << "  video  " << videoCalls << ", " << asyncFrames
+              << " async, " << syncFrames << " sync, " << flushes
+              << " flushes, " << videoBytes << " bytes\n"
+              << "  compression " << compression << '\n'
+              << "  audio  " << audioCalls << ", " << audioSamples
+              << " samples\n"
+              << "  " << metadataFrames << " metadata frames, "
+              << connectionQueries << " connection queries, " << tallyQueries
+              << " tally queries\n"
+              << "  " << overwritten
+              << " frames written to before they were handed back\n";
+  }
+
+  void sendVideo(NDIlib_video_frame_v2_t const *video, bool async) {
+    auto const start = Clock::now();
+    release();
+    if (video == nullptr || video->p_data == nullptr) {
+      auto const stats = std::scoped_lock{statsMutex};
+      flushes++;
+      videoCalls.add(Clock::now() - start);
+      return;
+    }
+    paceVideo(*video);
+    auto const bytes = FrameBytes(*video);
+    if (async) {
+      auto const lock = std::scoped_lock{mutex};
+      held = *video;
+      heldBytes = bytes;
+      heldFingerprint = Fingerprint(video->p_data, bytes);
+      holding = true;
+      working = true;
+      condition.notify_all();
+    } else {
+      auto const took = compress(*video, bytes);
+      auto const stats = std::scoped_lock{statsMutex};
+      compression.add(took);
+    }
+    auto const stats = std::scoped_lock{statsMutex};
+    (async ? asyncFrames : syncFrames)++;
+    videoBytes += bytes;
+    videoCalls.add(Clock::now() - start);
+  }
+
+  void sendAudio(NDIlib_audio_frame_v2_t const &audio) {
+    auto const start = Clock::now();
+    if (clockAudio && audio.sample_rate > 0) {
+      pace(nextAudio, std::chrono::duration_cast<Clock::duration>(
+                          std::chrono::duration<double>{
+                              static_cast<double>(audio.no_samples) /
+                              audio.sample_rate}));
+    }
+    auto const stats = std::scoped_lock{statsMutex};
+    audioSamples += static_cast<std::uint64_t>(audio.no_samples);
+    audioCalls.add(Clock::now() - start);
+  }
+
+  void sendMetadata() {
+    auto const stats = std::scoped_lock{statsMutex};
+    metadataFrames++;
+  }
+
+  auto connections(std::uint32_t timeout) -> int {
+    {
+      auto const stats = std::scoped_lock{statsMutex};
+      connectionQueries++;
+    }
+    if (settings().connections == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{timeout});
+    }
+    return settings().connections;
+  }
+
+  auto tally(NDIlib_tally_t *tally, std::uint32_t timeout) -> bool {
+    auto first = false;
+    {
+      auto const stats = std::scoped_lock{statsMutex};
+      first = tallyQueries++ == 0;
+    }
+    if (tally != nullptr) {
+      *tally = settings().tally;
+    }
+    if (!first) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{timeout});
+    }
+    return first;
+  }
+
+  auto sourceName() const -> NDIlib_source_t const * { return &source; }
+};
+
+struct Receiver {
+  std::string name;
+};
+
+// Every capture returns the same frame, or none
+class FrameSync {
+private:
+  std::vector<std::uint8_t> frame;
+  std::uint64_t captures = 0;
+
+public:
+  FrameSync() {
+    auto const &s = settings();
+    // UYVY grey, two pixels at a time
+    auto const grey = std::uint32_t{0x80808080};
+    frame.resize(static_cast<std::size_t>(s.sourceWidth) * s.sourceHeight * 2);
+    for (auto i = std::size_t{0}; i + 4 <= frame.size(); i += 4) {
+      std::memcpy(frame.data() + i, &grey, 4);
+    }
+  }
+
+  ~FrameSync() {
+    std::cerr << "ndi stub: frame sync returned " << captures << " frames\n";
+  }
+
+  void capture(NDIlib_video_frame_v2_t *video,
+               NDIlib_frame_format_type_e format) {
+    captures++;
+    *video = NDIlib_video_frame_v2_t{};
+    if (frame.empty()) {
+      return;
+    }
+    auto const &s = settings();
+    *video = NDIlib_video_frame_v2_t{s.sourceWidth,
+                                     s.sourceHeight,
+                                     NDIlib_FourCC_type_UYVY,
+                                     25,
+                                     1,
+                                     0.0f,
+                                     format,
+                                     NDIlib_send_timecode_synthesize,
+                                     frame.data(),
+                                     s.sourceWidth * 2};
+  }
+};
+
+[[noreturn]] void Unsupported() {
+  std::cerr << "ndi stub: called a function the stub does not provide\n";
+  std::abort();
+}
+
+auto MakeTable() -> NDIlib_v5 {
+  auto t = NDIlib_v5{};
+  t.initialize = [] { return true; };
+  t.destroy = [] {};
+  t.version = [] { return "NDI stub"; };
+  t.is_supported_CPU = [] { return true; };
+
+  t.find_create_v2 = [](NDIlib_find_create_t const *) -> NDIlib_find_instance_t {
+    return new int{};
+  };
+  t.find_destroy = [](NDIlib_find_instance_t find) {
+    delete static_cast<int *>(find);
+  };
+  t.find_wait_for_sources = [](NDIlib_find_instance_t, std::uint32_t timeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{timeout});
+    return false;
+  };
+  t.find_get_current_sources =
+      [](NDIlib_find_instance_t, std::uint32_t *count)
+      -> NDIlib_source_t const * {
+    *count = 0;
+    return nullptr;
+  };
+
+  t.send_create =
+      [](NDIlib_send_create_t const *create) -> NDIlib_send_instance_t {
+    return new Sender{create != nullptr ? *create : NDIlib_send_create_t{}};
+  };
+  t.send_destroy = [](NDIlib_send_instance_t sender) {
+    delete static_cast<Sender *>(sender);
+  };
+  t.send_send_video_v2 = [](NDIlib_send_instance_t sender,
+                            NDIlib_video_frame_v2_t const *video) {
+    static_cast<Sender *>(sender)->sendVideo(video, false);
+  };
+  t.send_send_video_async_v2 = [](NDIlib_send_instance_t sender,
+                                  NDIlib_video_frame_v2_t const *video) {
+    static_cast<Sender *>(sender)->sendVideo(video, true);
+  };
+  t.send_send_audio_v2 = [](NDIlib_send_instance_t sender,
+                            NDIlib_audio_frame_v2_t const *audio) {
+    static_cast<Sender *>(sender)->sendAudio(*audio);
+  };
+  t.send_send_metadata = [](NDIlib_send_instance_t sender,
+                            NDIlib_metadata_frame_t const *) {
+    static_cast<Sender *>(sender)->sendMetadata();
+  };
+  t.send_capture = [](NDIlib_send_instance_t, NDIlib_metadata_frame_t *,
+                      std::uint32_t timeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{timeout});
+    return NDIlib_frame_type_none;
+  };
+  t.send_free_metadata = [](NDIlib_send_instance_t,
+                            NDIlib_metadata_frame_t const *) {};
+  t.send_get_tally = [](NDIlib_send_instance_t sender, NDIlib_tally_t *tally,
+                        std::uint32_t timeout) {
+    return static_cast<Sender *>(sender)->tally(tally, timeout);
+  };
+  t.send_get_no_connections = [](NDIlib_send_instance_t sender,
+                                 std::uint32_t timeout) {
+    return static_cast<Sender *>(sender)->connections(timeout);
+  };
+  t.send_clear_connection_metadata = [](NDIlib_send_instance_t) {};
+  t.send_add_connection_metadata = [](NDIlib_send_instance_t,
+                                      NDIlib_metadata_frame_t const *) {};
+  t.send_set_failover = [](NDIlib_send_instance_t, NDIlib_source_t const *) {};
+  t.send_get_source_name = [](NDIlib_send_instance_t sender) {
+    return static_cast<Sender *>(sender)->sourceName();
+  };
+
+  t.recv_create_v3 =
+      [](NDIlib_recv_create_v3_t const *create) -> NDIlib_recv_instance_t {
+    return new Receiver{create != nullptr && create->p_ndi_recv_name != nullptr
+                            ? create->p_ndi_recv_name
+                            : ""};
+  };
+  t.recv_destroy = [](NDIlib_recv_instance_t receiver) {
+    delete static_cast<Receiver *>(receiver);
+  };
+  t.recv_capture_v2 = [](NDIlib_recv_instance_t, NDIlib_video_frame_v2_t *,
+                         NDIlib_audio_frame_v2_t *, NDIlib_metadata_frame_t *,
+                         std::uint32_t timeout) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{timeout});
+    return NDIlib_frame_type_none;
+  };
+  t.recv_free_video_v2 = [](NDIlib_recv_instance_t,
+                            NDIlib_video_frame_v2_t const *) {};
+  t.recv_free_audio_v2 = [](NDIlib_recv_instance_t,
+                            NDIlib_audio_frame_v2_t const *) {};
+  t.recv_free_metadata = [](NDIlib_recv_instance_t,
+                            NDIlib_metadata_frame_t const *) {};
+  t.recv_get_no_connections = [](NDIlib_recv_instance_t) { return 0; };
+
+  t.framesync_create = [](NDIlib_recv_instance_t)
+      -> NDIlib_framesync_instance_t { return new FrameSync{}; };
+  t.framesync_destroy = [](NDIlib_framesync_instance_t framesync) {
+    delete static_cast<FrameSync *>(framesync);
+  };
+  t.framesync_capture_video = [](NDIlib_framesync_instance_t framesync,
+                                 NDIlib_video_frame_v2_t *video,
+                                 NDIlib_frame_format_type_e format) {
+    static_cast<FrameSync *>(framesync)->capture(video, format);
+  };
+  t.framesync_free_video = [](NDIlib_framesync_instance_t,
+                              NDIlib_video_frame_v2_t *) {};
+  t.framesync_capture_audio = [](NDIlib_framesync_instance_t,
+                                 NDIlib_audio_frame_v2_t *audio, int, int,
+                                 int) { *audio = NDIlib_audio_frame_v2_t{}; };
+  t.framesync_free_audio = [](NDIlib_framesync_instance_t,
+                              NDIlib_audio_frame_v2_t *) {};
+  t.framesync_audio_queue_depth = [](NDIlib_framesync_instance_t) {
+    return 0;
+  };
+
+  // Everything else is out of scope for a stand-in, and fails loudly rather
+  // than crashing on a null pointer
+  using Slot = void (*)();
+  static_assert(sizeof(NDIlib_v5) % sizeof(Slot) == 0);
+  auto slots = reinterpret_cast<Slot *>(&t);
+  for (auto i = std::size_t{0}; i < sizeof(NDIlib_v5) / sizeof(Slot); i++) {
+    if (slots[i] == nullptr) {
+      slots[i] = Unsupported;
+    }
+  }
+  return t;
+}
+
+} // namespace
+
+const NDIlib_v5 *NDIlib_v5_load(void) {
+  static auto const table = MakeTable();
+  return &table;
+}
@@ -0,0 +1,83 @@
+// Times the v210 to P216 kernels on a UHD frame, optionally against the NDI
+// runtime's own NDIlib_util_V210_to_P216
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "../ndi.h"
+#include "../v210.h"
+
+constexpr auto width = 3840l;
+constexpr auto height = 2160l;
+constexpr auto iterations = 100;
+constexpr auto frameTime = std::chrono::duration<double, std::milli>{1000.0 / 60};
+
+auto time(auto const &convert) {
+  auto best = std::chrono::duration<double, std::milli>::max();
+  auto total = std::chrono::duration<double, std::milli>{};
+  for (auto i = 0; i < iterations; i++) {
+    auto const start = std::chrono::steady_clock::now();
+    convert();
+    auto const elapsed = std::chrono::duration<double, std::milli>{
+        std::chrono::steady_clock::now() - start};
+    best = std::min(best, elapsed);
+    total += elapsed;
+  }
+  return std::pair{best, total / iterations};
+}
+
+void report(std::string_view name, auto const &times, bool matches) {
+  auto const [best, mean] = times;
+  std::cout << name << ": best " << best.count() << "ms, mean " << mean.count()
+            << "ms, " << 100 * mean / frameTime << "% of a 60p frame"
+            << (matches ? "" : ", OUTPUT DIFFERS") << '\n';
+}
+
+int main(int argc, char **argv) {
+  auto const useNdi = argc > 1 && std::string_view{argv[1]} == "--ndi";
+
+  auto const rowBytes = v210::RowBytes(width);
+  auto src = std::vector<std::uint8_t>(rowBytes * height);
+  auto random = std::mt19937{};
+  std::generate(src.begin(), src.end(), [&] { return random(); });
+
+  auto expected = std::vector<std::uint16_t>(width * height * 2);
+  v210::ToP216(src.data(), rowBytes, expected.data(), width, height,
+               v210::RowScalar);
+
+  auto dst = std::vector<std::uint16_t>(width * height * 2);
+  for (auto const &kernel : v210::Kernels()) {
+    std::fill(dst.begin(), dst.end(), 0);
+    auto const times = time([&] {
+      v210::ToP216(src.data(), rowBytes, dst.data(), width, height,
+                   kernel.row);
+    });
+    report(kernel.name, times, dst == expected);
+  }
+
+  if (useNdi) {
+    auto const ndi = NdiLibrary{};
+    auto source = NDIlib_video_frame_v2_t{};
+    source.xres = width;
+    source.yres = height;
+    source.p_data = src.data();
+    source.line_stride_in_bytes = rowBytes;
+    auto destination = NDIlib_video_frame_v2_t{};
+    destination.xres = width;
+    destination.yres = height;
+    destination.FourCC = NDIlib_FourCC_type_P216;
+    destination.p_data = reinterpret_cast<std::uint8_t *>(dst.data());
+    destination.line_stride_in_bytes = width * 2;
+
+    std::fill(dst.begin(), dst.end(), 0);
+    auto const times =
+        time([&] { ndi->util_V210_to_P216(&source, &destination); });
+    report("NDIlib_util_V210_to_P216", times, dst == expected);
+  }
+}
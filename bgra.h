@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+// Packs BGRA or BGRX (8 bit, blue first) into UYVY (8 bit 4:2:2, Cb Y Cr Y),
+// for the sources with alpha that an NDI receiver asking for UYVY_BGRA gets
+// as BGRA. Alpha has nowhere to go and is dropped.
+//
+// Studio range, with chroma averaged over each pair of pixels. Coefficients
+// are scaled by 256.
+
+namespace bgra {
+
+struct Matrix {
+  int y[3];
+  int cb[3];
+  int cr[3];
+};
+
+// R, G and B weights
+constexpr auto bt601 =
+    Matrix{{66, 129, 25}, {-38, -74, 112}, {112, -94, -18}};
+constexpr auto bt709 =
+    Matrix{{47, 157, 16}, {-26, -86, 112}, {112, -102, -10}};
+
+// As NDI assumes for frames that do not say: HD and up is BT.709
+constexpr auto ForHeight(long height) -> Matrix const & {
+  return height >= 720 ? bt709 : bt601;
+}
+
+inline auto Apply(int const (&w)[3], int r, int g, int b) {
+  return w[0] * r + w[1] * g + w[2] * b;
+}
+
+inline void RowToUyvy(std::uint8_t const *src, std::uint8_t *dst, long width,
+                      Matrix const &m) {
+  for (auto x = 0l; x + 1 < width; x += 2, src += 8, dst += 4) {
+    auto const b0 = src[0], g0 = src[1], r0 = src[2];
+    auto const b1 = src[4], g1 = src[5], r1 = src[6];
+    auto const r = r0 + r1, g = g0 + g1, b = b0 + b1;
+    dst[0] = static_cast<std::uint8_t>(
+        ((Apply(m.cb, r, g, b) + 256) >> 9) + 128);
+    dst[1] = static_cast<std::uint8_t>(
+        ((Apply(m.y, r0, g0, b0) + 128) >> 8) + 16);
+    dst[2] = static_cast<std::uint8_t>(
+        ((Apply(m.cr, r, g, b) + 256) >> 9) + 128);
+    dst[3] = static_cast<std::uint8_t>(
+        ((Apply(m.y, r1, g1, b1) + 128) >> 8) + 16);
+  }
+}
+
+} // namespace bgra
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "decklink.h"
+
+#if defined(UNIX)
+#include <sys/mman.h>
+#include <unistd.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif
+
+struct BufferPoolStats {
+  std::size_t bufferSize;
+  std::size_t allocations;
+  std::size_t misses;
+  std::size_t outstanding;
+  std::size_t highWaterMark;
+  std::size_t idle;
+};
+
+inline auto operator<<(std::ostream &os, BufferPoolStats const &stats)
+    -> std::ostream & {
+  return os << stats.allocations << " allocations of " << stats.bufferSize
+            << " bytes, " << stats.misses << " misses, " << stats.outstanding
+            << " outstanding, high-water mark " << stats.highWaterMark << ", "
+            << stats.idle << " idle";
+}
+
+// Recycles page aligned, pre-faulted buffers so that steady state capture
+// never touches the system allocator or takes a page fault
+class BufferPool {
+private:
+  bool hugePages;
+
+  mutable std::mutex mutex;
+  std::size_t bufferSize = 0;
+  std::size_t mappedSize = 0;
+  std::vector<void *> idle;
+  std::unordered_map<void *, std::size_t> sizes;
+  std::size_t allocations = 0;
+  std::size_t misses = 0;
+  std::size_t highWaterMark = 0;
+
+  // Copies of the above for stats(), which must never wait on capture.
+  // Only written with the mutex held.
+  struct {
+    std::atomic<std::size_t> bufferSize = 0;
+    std::atomic<std::size_t> allocations = 0;
+    std::atomic<std::size_t> misses = 0;
+    std::atomic<std::size_t> outstanding = 0;
+    std::atomic<std::size_t> highWaterMark = 0;
+    std::atomic<std::size_t> idle = 0;
+  } published;
+
+  void publish() {
+    published.bufferSize.store(bufferSize, std::memory_order_relaxed);
+    published.allocations.store(allocations, std::memory_order_relaxed);
+    published.misses.store(misses, std::memory_order_relaxed);
+    published.outstanding.store(sizes.size() - idle.size(),
+                                std::memory_order_relaxed);
+    published.highWaterMark.store(highWaterMark, std::memory_order_relaxed);
+    published.idle.store(idle.size(), std::memory_order_relaxed);
+  }
+
+  static auto pageSize() -> std::size_t {
+#if defined(UNIX)
+    return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(WIN32)
+    auto info = SYSTEM_INFO{};
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#endif
+  }
+
+  static constexpr auto hugePageSize = std::size_t{2} << 20;
+
+  static auto roundUp(std::size_t size, std::size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  auto map(std::size_t size) -> void * {
+    void *p = nullptr;
+#if defined(__linux__)
+    if (hugePages) {
+      p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1,
+               0);
+      if (p == MAP_FAILED) {
+        p = nullptr;
+      }
+    }
+    if (p == nullptr) {
+      p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) {
+        return nullptr;
+      }
+      if (hugePages) {
+        madvise(p, size, MADV_HUGEPAGE);
+      }
+    }
+#elif defined(UNIX)
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1,
+             0);
+    if (p == MAP_FAILED) {
+      return nullptr;
+    }
+#elif defined(WIN32)
+    if (hugePages) {
+      p = VirtualAlloc(nullptr, size,
+                       MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                       PAGE_READWRITE);
+    }
+    if (p == nullptr) {
+      p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT,
+                       PAGE_READWRITE);
+    }
+#endif
+    if (p != nullptr) {
+      auto const step = pageSize();
+      auto bytes = static_cast<volatile std::uint8_t *>(p);
+      for (auto offset = std::size_t{0}; offset < size; offset += step) {
+        bytes[offset] = 0;
+      }
+    }
+    return p;
+  }
+
+  static void unmap(void *p, std::size_t size) {
+#if defined(UNIX)
+    munmap(p, size);
+#elif defined(WIN32)
+    VirtualFree(p, 0, MEM_RELEASE);
+#endif
+  }
+
+  void freeIdle() {
+    for (auto p : idle) {
+      auto const it = sizes.find(p);
+      unmap(p, it->second);
+      sizes.erase(it);
+    }
+    idle.clear();
+  }
+
+  void resize(std::size_t size) {
+    if (size != bufferSize) {
+      freeIdle();
+      bufferSize = size;
+      mappedSize = roundUp(size, hugePages ? hugePageSize : pageSize());
+    }
+  }
+
+public:
+  explicit BufferPool(bool hugePages = false) : hugePages{hugePages} {}
+
+  BufferPool(BufferPool const &) = delete;
+  BufferPool &operator=(BufferPool const &) = delete;
+  BufferPool(BufferPool &&) = delete;
+  BufferPool &operator=(BufferPool &&) = delete;
+
+  ~BufferPool() {
+    auto lock = std::scoped_lock{mutex};
+    if (sizes.size() != idle.size()) {
+      std::cerr << "Buffer pool destroyed with buffers outstanding\n";
+    }
+    freeIdle();
+  }
+
+  auto acquire(std::size_t size) -> void * {
+    auto lock = std::scoped_lock{mutex};
+    resize(size);
+    auto p = static_cast<void *>(nullptr);
+    if (idle.empty()) {
+      p = map(mappedSize);
+      if (p == nullptr) {
+        publish();
+        return nullptr;
+      }
+      sizes.emplace(p, mappedSize);
+      allocations++;
+      misses++;
+    } else {
+      p = idle.back();
+      idle.pop_back();
+    }
+    highWaterMark = std::max(highWaterMark, sizes.size() - idle.size());
+    publish();
+    return p;
+  }
+
+  void release(void *p) {
+    auto lock = std::scoped_lock{mutex};
+    auto const it = sizes.find(p);
+    if (it == sizes.end()) {
+      std::cerr << "Buffer released to the wrong pool\n";
+      return;
+    }
+    if (it->second != mappedSize) {
+      unmap(p, it->second);
+      sizes.erase(it);
+    } else {
+      idle.push_back(p);
+    }
+    publish();
+  }
+
+  void reserve(std::size_t size, std::size_t count) {
+    auto lock = std::scoped_lock{mutex};
+    resize(size);
+    while (idle.size() < count) {
+      auto const p = map(mappedSize);
+      if (p == nullptr) {
+        break;
+      }
+      sizes.emplace(p, mappedSize);
+      idle.push_back(p);
+      allocations++;
+    }
+    publish();
+  }
+
+  void trim() {
+    auto lock = std::scoped_lock{mutex};
+    freeIdle();
+    publish();
+  }
+
+  // Each figure is current, though they may straddle an acquire or release
+  auto stats() const -> BufferPoolStats {
+    return {published.bufferSize.load(std::memory_order_relaxed),
+            published.allocations.load(std::memory_order_relaxed),
+            published.misses.load(std::memory_order_relaxed),
+            published.outstanding.load(std::memory_order_relaxed),
+            published.highWaterMark.load(std::memory_order_relaxed),
+            published.idle.load(std::memory_order_relaxed)};
+  }
+};
+
+struct BufferPoolRelease {
+  BufferPool *pool;
+
+  void operator()(void *p) const {
+    if (p != nullptr) {
+      pool->release(p);
+    }
+  }
+};
+
+using PooledBuffer = std::unique_ptr<void, BufferPoolRelease>;
+
+inline auto Acquire(BufferPool &pool, std::size_t size) -> PooledBuffer {
+  return {pool.acquire(size), BufferPoolRelease{&pool}};
+}
+
+// Lets the driver capture straight into BufferPool memory, which is then
+// handed to NDI as is
+class DeckLinkAllocator : public ComObject<IDeckLinkMemoryAllocator> {
+private:
+  BufferPool pool;
+  // Written from the format change callback, read on the driver's thread
+  std::atomic<std::size_t> frameSize;
+  std::size_t frameCount;
+
+public:
+  DeckLinkAllocator(bool hugePages, std::size_t frameSize,
+                    std::size_t frameCount)
+      : pool{hugePages}, frameSize{frameSize}, frameCount{frameCount} {}
+
+  void expect(std::size_t size) {
+    frameSize.store(size, std::memory_order_relaxed);
+  }
+
+  auto stats() const { return pool.stats(); }
+
+  auto AllocateBuffer(uint32_t bufferSize, void **allocatedBuffer)
+      -> HRESULT override {
+    *allocatedBuffer = pool.acquire(bufferSize);
+    return *allocatedBuffer != nullptr ? S_OK : E_OUTOFMEMORY;
+  }
+
+  auto ReleaseBuffer(void *buffer) -> HRESULT override {
+    pool.release(buffer);
+    return S_OK;
+  }
+
+  auto Commit() -> HRESULT override {
+    if (auto size = frameSize.load(std::memory_order_relaxed); size != 0) {
+      pool.reserve(size, frameCount);
+    }
+    return S_OK;
+  }
+
+  auto Decommit() -> HRESULT override {
+    pool.trim();
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    if (IsIUnknown(iid) || SameIID(iid, IID_IDeckLinkMemoryAllocator)) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkMemoryAllocator *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+};
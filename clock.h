@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+// NDI timecodes are in 100ns units since the UNIX epoch
+inline constexpr auto ndiTicksPerSecond = std::int64_t{10'000'000};
+
+inline auto NdiNow() -> std::int64_t {
+  return std::chrono::duration_cast<
+             std::chrono::duration<std::int64_t, std::ratio<1, 10'000'000>>>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Maps the card's hardware reference clock onto the system clock. A second
+// order loop tracks the rate between the two, so callback jitter is smoothed
+// out while drift is followed, and the result never goes backwards.
+//
+// Only touched from the driver's capture thread.
+class ClockRecovery {
+private:
+  // Phase and frequency gains, critically damped with a time constant of
+  // around 32 frames
+  static constexpr auto phaseGain = 1.0 / 32;
+  static constexpr auto frequencyGain = phaseGain * phaseGain / 4;
+  // Further out than this the clocks have jumped rather than drifted
+  static constexpr auto resyncThreshold = ndiTicksPerSecond / 10;
+
+  bool locked = false;
+  std::int64_t hardware = 0;
+  std::int64_t estimate = 0;
+  double rate = 1.0;
+  std::int64_t last = 0;
+  std::atomic<double> drift = 0.0;
+
+public:
+  // Both in 100ns units, hardwareTime from GetHardwareReferenceTimestamp and
+  // systemTime from NdiNow() as the frame arrived
+  auto map(std::int64_t hardwareTime, std::int64_t systemTime)
+      -> std::int64_t {
+    auto const elapsed = hardwareTime - hardware;
+    auto const advance = static_cast<double>(elapsed) * rate;
+    auto const error = static_cast<double>(systemTime - estimate) - advance;
+    if (!locked || elapsed <= 0 || std::abs(error) > resyncThreshold) {
+      locked = true;
+      estimate = systemTime;
+      rate = 1.0;
+    } else {
+      estimate += std::llround(advance + phaseGain * error);
+      rate += frequencyGain * error / static_cast<double>(elapsed);
+    }
+    hardware = hardwareTime;
+    drift.store((1.0 - rate) * 1e6, std::memory_order_relaxed);
+
+    last = std::max(estimate, last + 1);
+    return last;
+  }
+
+  // How much faster the hardware clock runs than the system clock, in parts
+  // per million
+  auto driftPpm() const { return drift.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+// Written by a single thread and read from anywhere, so updates are plain
+// stores rather than read-modify-writes
+class Counter {
+private:
+  std::atomic<std::uint64_t> value = 0;
+
+public:
+  void add(std::uint64_t n = 1) {
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+
+  void max(std::uint64_t n) {
+    if (n > value.load(std::memory_order_relaxed)) {
+      value.store(n, std::memory_order_relaxed);
+    }
+  }
+
+  auto load() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Video frames a sink had no room for, by what its drop policy did about
+// it, see backpressure.h, or no memory to send from
+struct DropStats {
+  // Turned away with the ring full
+  std::uint64_t overflows;
+  // Skipped for newer frames behind them
+  std::uint64_t stale;
+  // Still no room when blocking gave up
+  std::uint64_t timeouts;
+  // Skipped to halve the frame rate
+  std::uint64_t halved;
+  // No memory to convert, deinterlace or scale into
+  std::uint64_t noMemory;
+  // Audio packets turned away with their frame, or alone, for want of room.
+  // Not frames, so not in the total.
+  std::uint64_t audio;
+
+  auto total() const {
+    return overflows + stale + timeouts + halved + noMemory;
+  }
+};
+
+struct DropCounters {
+  Counter overflows;
+  Counter stale;
+  Counter timeouts;
+  Counter halved;
+  Counter noMemory;
+  Counter audio;
+
+  auto load() const -> DropStats {
+    return {overflows.load(), stale.load(), timeouts.load(), halved.load(),
+            noMemory.load(), audio.load()};
+  }
+};
+
+inline auto operator<<(std::ostream &os, DropStats const &stats)
+    -> std::ostream & {
+  return os << stats.overflows << " dropped on overflow, " << stats.stale
+            << " dropped as stale, " << stats.timeouts
+            << " dropped after blocking, " << stats.halved
+            << " skipped at half rate, " << stats.noMemory
+            << " dropped for want of memory, " << stats.audio
+            << " audio packets dropped";
+}
+
+struct StreamCounters {
+  Counter captured;
+  Counter missed;
+  Counter sent;
+  Counter audioSent;
+  // Video frames that arrived without audio, with audio enabled
+  Counter audioMissing;
+  Counter unwatched;
+  DropCounters drops;
+  // Frames the driver had queued when it was flushed for falling behind
+  Counter flushed;
+  Counter queueLatencyTotal;
+  Counter queueLatencyMax;
+  Counter formatChanges;
+  Counter formatChangeFramesLost;
+  // Nanoseconds, one for each thread a stream has to itself
+  Counter captureCpu;
+  Counter senderCpu;
+};
+
+struct StreamStats {
+  std::uint64_t captured;
+  std::uint64_t missed;
+  std::uint64_t sent;
+  std::uint64_t audioSent;
+  std::uint64_t audioMissing;
+  std::uint64_t unwatched;
+  DropStats drops;
+  std::uint64_t flushed;
+  std::uint64_t queued;
+  std::uint64_t queueLatencyTotal;
+  std::uint64_t queueLatencyMax;
+  std::uint64_t formatChanges;
+  std::uint64_t formatChangeFramesLost;
+  std::uint64_t cpuTime;
+  double clockDriftPpm;
+};
+
+inline auto operator<<(std::ostream &os, StreamStats const &stats)
+    -> std::ostream & {
+  auto const mean = stats.sent == 0 ? 0 : stats.queueLatencyTotal / stats.sent;
+  return os << stats.captured << " captured, " << stats.missed
+            << " missed by the driver, " << stats.sent << " sent, "
+            << stats.audioSent << " audio packets sent, "
+            << stats.audioMissing << " frames without audio, "
+            << stats.unwatched
+            << " skipped with no receivers, "
+            << stats.drops << ", " << stats.flushed
+            << " flushed from the driver, " << stats.queued
+            << " queued, queue latency mean " << mean / 1000 << "us max "
+            << stats.queueLatencyMax / 1000 << "us, " << stats.formatChanges
+            << " format changes losing " << stats.formatChangeFramesLost
+            << " frames, " << stats.cpuTime / 1'000'000
+            << "ms CPU, reference clock drift " << stats.clockDriftPpm << "ppm";
+}
+
+// For a sink fed alongside a stream's own sender
+struct SinkCounters {
+  Counter sent;
+  Counter unwatched;
+  DropCounters drops;
+};
+
+struct SinkStats {
+  std::uint64_t sent;
+  std::uint64_t unwatched;
+  DropStats drops;
+  std::uint64_t queued;
+};
+
+inline auto operator<<(std::ostream &os, SinkStats const &stats)
+    -> std::ostream & {
+  return os << stats.sent << " sent, " << stats.unwatched
+            << " skipped with no receivers, " << stats.drops << ", "
+            << stats.queued << " queued";
+}
+
+struct PlayoutCounters {
+  Counter scheduled;
+  Counter copied;
+  Counter blank;
+  Counter late;
+  Counter dropped;
+};
+
+struct PlayoutStats {
+  std::uint64_t scheduled;
+  std::uint64_t copied;
+  std::uint64_t blank;
+  std::uint64_t late;
+  std::uint64_t dropped;
+  std::size_t depth;
+};
+
+inline auto operator<<(std::ostream &os, PlayoutStats const &stats)
+    -> std::ostream & {
+  return os << stats.scheduled << " scheduled, " << stats.copied
+            << " copied to suit DeckLink, " << stats.blank
+            << " blank for want of a matching source, " << stats.late
+            << " late, " << stats.dropped << " dropped, buffering "
+            << stats.depth << " frames";
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define X86
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ARM64
+#endif
+
+#if defined(X86)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(ARM64)
+#include <arm_neon.h>
+#endif
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <time.h>
+#endif
+
+// Kernels for instruction sets beyond the build's baseline are compiled with
+// this and only called once the CPU has been checked
+#if defined(X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+#if defined(X86)
+inline auto CpuHasSse41() -> bool {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 19)) != 0;
+#else
+  return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+inline auto CpuHasAvx2() -> bool {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  auto const osxsave = (info[2] & (1 << 27)) != 0;
+  auto const avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Keeps the calling thread on one core, so its working set stays in that
+// core's caches. macOS only takes affinity hints, so there this does nothing
+inline auto PinCurrentThread(unsigned core) -> bool {
+#if defined(__linux__)
+  auto set = cpu_set_t{};
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(WIN32)
+  return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR{1} << core) != 0;
+#else
+  return false;
+#endif
+}
+
+#if defined(WIN32)
+inline auto FileTimeDuration(FILETIME const &kernel, FILETIME const &user)
+    -> std::chrono::nanoseconds {
+  auto const ticks = [](FILETIME const &t) {
+    return static_cast<std::uint64_t>(t.dwHighDateTime) << 32 |
+           t.dwLowDateTime;
+  };
+  return std::chrono::nanoseconds{(ticks(kernel) + ticks(user)) * 100};
+}
+#endif
+
+// CPU time the calling thread has used so far, zero where it cannot be told
+inline auto ThreadCpuTime() -> std::chrono::nanoseconds {
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+  auto ts = timespec{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+#elif defined(WIN32)
+  FILETIME creation, exit, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+  return FileTimeDuration(kernel, user);
+#else
+  return {};
+#endif
+}
+
+// CPU time every thread in the process has used so far, NDI's included
+inline auto ProcessCpuTime() -> std::chrono::nanoseconds {
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+  auto ts = timespec{};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+#elif defined(WIN32)
+  FILETIME creation, exit, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+  return FileTimeDuration(kernel, user);
+#else
+  return {};
+#endif
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+
+#if defined(__unix__) || defined(__unix) ||                                    \
+    (defined(__APPLE__) && defined(__MACH__))
+#define UNIX
+#endif
+
+#if defined(UNIX)
+#include <DeckLinkAPI.h>
+#elif defined(WIN32)
+#include <DeckLinkAPI_i.h>
+#endif
+
+#if defined(UNIX)
+constexpr auto True = true;
+constexpr auto False = false;
+#elif defined(WIN32)
+constexpr auto True = TRUE;
+constexpr auto False = FALSE;
+#endif
+
+struct DeckLinkRelease {
+  void operator()(IUnknown *p) {
+    if (p != nullptr) {
+      p->Release();
+    }
+  }
+};
+
+template <typename T> using DeckLinkPtr = std::unique_ptr<T, DeckLinkRelease>;
+
+template <typename T> auto MakeDeckLinkPtr(T *p) { return DeckLinkPtr<T>{p}; }
+
+// A reference that can be shared, each copy holding a reference of its own,
+// so the object is only released once the last copy goes
+template <typename T> class DeckLinkRef {
+private:
+  T *p = nullptr;
+
+public:
+  DeckLinkRef() = default;
+
+  // Takes a new reference to p
+  explicit DeckLinkRef(T *p) : p{p} {
+    if (p != nullptr) {
+      p->AddRef();
+    }
+  }
+
+  DeckLinkRef(DeckLinkRef const &other) : DeckLinkRef{other.p} {}
+  DeckLinkRef(DeckLinkRef &&other) noexcept
+      : p{std::exchange(other.p, nullptr)} {}
+
+  DeckLinkRef &operator=(DeckLinkRef other) noexcept {
+    std::swap(p, other.p);
+    return *this;
+  }
+
+  ~DeckLinkRef() { reset(); }
+
+  void reset() {
+    if (auto const old = std::exchange(p, nullptr); old != nullptr) {
+      old->Release();
+    }
+  }
+
+  auto get() const { return p; }
+  auto operator->() const { return p; }
+  explicit operator bool() const { return p != nullptr; }
+  friend auto operator==(DeckLinkRef const &ref, std::nullptr_t) {
+    return ref.p == nullptr;
+  }
+};
+
+struct DLString {
+#if defined(__linux__)
+  char const * data;
+#elif defined(__APPLE__) && defined(__MACH__)
+  CFStringRef data;
+#elif defined(WIN32)
+  BSTR data;
+#endif
+
+  void print() const {
+#if defined(__linux__)
+    std::cout << data;
+#elif defined(__APPLE__) && defined(__MACH__)
+    std::cout << CFStringGetCStringPtr(data, kCFStringEncodingASCII);
+#elif defined(WIN32)
+    std::wcout << data;
+#endif
+  }
+
+  auto str() const -> std::string {
+#if defined(__linux__)
+    return data;
+#elif defined(__APPLE__) && defined(__MACH__)
+    char buffer[256];
+    CFStringGetCString(data, buffer, sizeof(buffer), kCFStringEncodingUTF8);
+    return buffer;
+#elif defined(WIN32)
+    auto const size = WideCharToMultiByte(CP_UTF8, 0, data, -1, nullptr, 0,
+                                          nullptr, nullptr);
+    auto result = std::string(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, data, -1, result.data(), size, nullptr,
+                        nullptr);
+    result.pop_back();
+    return result;
+#endif
+  }
+
+  ~DLString() {
+#if defined(__linux__)
+    free(const_cast<char*>(data));
+#elif defined(__APPLE__) && defined(__MACH__)
+    CFRelease(data);
+#elif defined(WIN32)
+    SysFreeString(data);
+#endif
+  }
+};
+
+inline auto SameIID(REFIID a, REFIID b) -> bool {
+  return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+inline auto IsIUnknown(REFIID iid) -> bool {
+#if defined(__APPLE__) && defined(__MACH__)
+  return SameIID(iid, CFUUIDGetUUIDBytes(IUnknownUUID));
+#else
+  return SameIID(iid, IID_IUnknown);
+#endif
+}
+
+// Reference counting for objects we hand to the driver, which may outlive
+// our own reference
+template <typename Interface> class ComObject : public Interface {
+private:
+  std::atomic<ULONG> refCount = 1;
+
+public:
+  auto AddRef() -> ULONG override { return ++refCount; }
+
+  auto Release() -> ULONG override {
+    auto const count = --refCount;
+    if (count == 0) {
+      delete this;
+    }
+    return count;
+  }
+
+protected:
+  virtual ~ComObject() = default;
+};
+
+inline auto RowBytes(BMDPixelFormat pixelFormat, long width) -> long {
+  switch (pixelFormat) {
+  case bmdFormat8BitYUV:
+    return width * 2;
+  case bmdFormat10BitYUV:
+    return (width + 47) / 48 * 128;
+  case bmdFormat8BitBGRA:
+    return width * 4;
+  default:
+    std::cerr << "Unsupported pixel format\n";
+    std::terminate();
+  }
+}
+
+inline auto PixelFormatName(BMDPixelFormat pixelFormat) -> char const * {
+  switch (pixelFormat) {
+  case bmdFormat8BitYUV:
+    return "8 bit YUV";
+  case bmdFormat10BitYUV:
+    return "10 bit YUV";
+  case bmdFormat8BitBGRA:
+    return "8 bit BGRA";
+  default:
+    return "unknown pixel format";
+  }
+}
+
+// The closest pixel format we can send to the signal format detection found
+inline auto DetectedPixelFormat(BMDDetectedVideoInputFormatFlags flags)
+    -> BMDPixelFormat {
+  if (flags & bmdDetectedVideoInputRGB444) {
+    return bmdFormat8BitBGRA;
+  }
+  if (flags & (bmdDetectedVideoInput10BitDepth |
+               bmdDetectedVideoInput12BitDepth)) {
+    return bmdFormat10BitYUV;
+  }
+  return bmdFormat8BitYUV;
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "cpu.h"
+#include "frame_descriptor.h"
+#include "options.h"
+#include "workers.h"
+
+// Turns each interlaced frame into two progressive ones, one at the time of
+// each field, doubling the frame rate.
+//
+// Bob keeps the field's own lines and fills the others with the mean of the
+// lines either side. Motion adaptive fills them from the other field instead
+// wherever the field's lines are unchanged since the previous frame, so still
+// parts of the picture keep their full vertical detail. It only looks back,
+// so adds no latency.
+//
+// Every component is treated alike, so the same kernels serve UYVY (8 bit,
+// interleaved) and P216 (16 bit, two planes).
+
+namespace deinterlace {
+
+// A difference no bigger than this, in 8 bit terms, is taken for noise
+constexpr auto stillThreshold = 12;
+
+template <typename T>
+using Interpolate = void (*)(T const *above, T const *below, T *out, long n);
+
+// prevAbove and prevBelow are the same lines in the previous frame, weave the
+// other field's line
+template <typename T>
+using Adapt = void (*)(T const *above, T const *below, T const *prevAbove,
+                       T const *prevBelow, T const *weave, T *out, long n);
+
+template <typename T> constexpr T Threshold() {
+  return static_cast<T>(stillThreshold << (8 * (sizeof(T) - 1)));
+}
+
+template <typename T>
+inline void InterpolateScalar(T const *above, T const *below, T *out, long n) {
+  for (auto x = 0l; x < n; x++) {
+    out[x] = static_cast<T>((above[x] + below[x] + 1) >> 1);
+  }
+}
+
+template <typename T>
+inline void AdaptScalar(T const *above, T const *below, T const *prevAbove,
+                        T const *prevBelow, T const *weave, T *out, long n) {
+  auto const diff = [](T a, T b) { return a > b ? a - b : b - a; };
+  for (auto x = 0l; x < n; x++) {
+    auto const motion =
+        std::max(diff(above[x], prevAbove[x]), diff(below[x], prevBelow[x]));
+    out[x] = motion <= Threshold<T>()
+                 ? weave[x]
+                 : static_cast<T>((above[x] + below[x] + 1) >> 1);
+  }
+}
+
+#if defined(X86)
+TARGET("avx2")
+inline auto Load(void const *p) {
+  return _mm256_loadu_si256(static_cast<__m256i const *>(p));
+}
+
+TARGET("avx2")
+inline void Store(void *p, __m256i v) {
+  _mm256_storeu_si256(static_cast<__m256i *>(p), v);
+}
+
+// Absolute differences of unsigned lanes
+TARGET("avx2")
+inline auto Diff8(__m256i a, __m256i b) {
+  return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+TARGET("avx2")
+inline auto Diff16(__m256i a, __m256i b) {
+  return _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+}
+
+TARGET("avx2")
+inline void InterpolateAvx2(std::uint8_t const *above,
+                            std::uint8_t const *below, std::uint8_t *out,
+                            long n) {
+  auto x = 0l;
+  for (; x + 32 <= n; x += 32) {
+    Store(out + x, _mm256_avg_epu8(Load(above + x), Load(below + x)));
+  }
+  InterpolateScalar(above + x, below + x, out + x, n - x);
+}
+
+TARGET("avx2")
+inline void InterpolateAvx2(std::uint16_t const *above,
+                            std::uint16_t const *below, std::uint16_t *out,
+                            long n) {
+  auto x = 0l;
+  for (; x + 16 <= n; x += 16) {
+    Store(out + x, _mm256_avg_epu16(Load(above + x), Load(below + x)));
+  }
+  InterpolateScalar(above + x, below + x, out + x, n - x);
+}
+
+TARGET("avx2")
+inline void AdaptAvx2(std::uint8_t const *above, std::uint8_t const *below,
+                      std::uint8_t const *prevAbove,
+                      std::uint8_t const *prevBelow, std::uint8_t const *weave,
+                      std::uint8_t *out, long n) {
+  auto const threshold =
+      _mm256_set1_epi8(static_cast<char>(Threshold<std::uint8_t>()));
+  auto x = 0l;
+  for (; x + 32 <= n; x += 32) {
+    auto const a = Load(above + x);
+    auto const b = Load(below + x);
+    auto const motion = _mm256_max_epu8(Diff8(a, Load(prevAbove + x)),
+                                        Diff8(b, Load(prevBelow + x)));
+    auto const still =
+        _mm256_cmpeq_epi8(_mm256_min_epu8(motion, threshold), motion);
+    Store(out + x,
+          _mm256_blendv_epi8(_mm256_avg_epu8(a, b), Load(weave + x), still));
+  }
+  AdaptScalar(above + x, below + x, prevAbove + x, prevBelow + x, weave + x,
+              out + x, n - x);
+}
+
+TARGET("avx2")
+inline void AdaptAvx2(std::uint16_t const *above, std::uint16_t const *below,
+                      std::uint16_t const *prevAbove,
+                      std::uint16_t const *prevBelow,
+                      std::uint16_t const *weave, std::uint16_t *out, long n) {
+  auto const threshold =
+      _mm256_set1_epi16(static_cast<short>(Threshold<std::uint16_t>()));
+  auto x = 0l;
+  for (; x + 16 <= n; x += 16) {
+    auto const a = Load(above + x);
+    auto const b = Load(below + x);
+    auto const motion = _mm256_max_epu16(Diff16(a, Load(prevAbove + x)),
+                                         Diff16(b, Load(prevBelow + x)));
+    auto const still =
+        _mm256_cmpeq_epi16(_mm256_min_epu16(motion, threshold), motion);
+    Store(out + x,
+          _mm256_blendv_epi8(_mm256_avg_epu16(a, b), Load(weave + x), still));
+  }
+  AdaptScalar(above + x, below + x, prevAbove + x, prevBelow + x, weave + x,
+              out + x, n - x);
+}
+#endif
+
+struct Kernels {
+  char const *name;
+  Interpolate<std::uint8_t> interpolate8;
+  Interpolate<std::uint16_t> interpolate16;
+  Adapt<std::uint8_t> adapt8;
+  Adapt<std::uint16_t> adapt16;
+};
+
+// The kernels this CPU can run, best first
+inline auto Available() -> std::vector<Kernels> {
+  auto kernels = std::vector<Kernels>{};
+#if defined(X86)
+  if (CpuHasAvx2()) {
+    kernels.push_back(
+        {"avx2", InterpolateAvx2, InterpolateAvx2, AdaptAvx2, AdaptAvx2});
+  }
+#endif
+  kernels.push_back({"scalar", InterpolateScalar<std::uint8_t>,
+                     InterpolateScalar<std::uint16_t>,
+                     AdaptScalar<std::uint8_t>, AdaptScalar<std::uint16_t>});
+  return kernels;
+}
+
+inline Kernels const best = Available().front();
+
+// Rows of one element size, stride bytes apart, offset bytes into the frame
+struct Plane {
+  std::size_t offset;
+  long stride;
+  long elements;
+  bool wide;
+};
+
+// The frame as it is sent to NDI, after any conversion
+inline auto Planes(FrameDescriptor const &descriptor) -> std::vector<Plane> {
+  if (descriptor.fourCC == NDIlib_FourCC_type_P216) {
+    auto const plane = static_cast<std::size_t>(descriptor.lineStride) *
+                       static_cast<std::size_t>(descriptor.height);
+    return {{0, descriptor.lineStride, descriptor.width, true},
+            {plane, descriptor.lineStride, descriptor.width, true}};
+  }
+  return {{0, descriptor.lineStride, descriptor.lineStride, false}};
+}
+
+inline auto FrameSize(FrameDescriptor const &descriptor) -> std::size_t {
+  auto size = std::size_t{0};
+  for (auto const &plane : Planes(descriptor)) {
+    size += static_cast<std::size_t>(plane.stride) *
+            static_cast<std::size_t>(descriptor.height);
+  }
+  return size;
+}
+
+// Rows first to last of the picture at the time of one field. previous is
+// null where there is no earlier frame to compare with.
+template <typename T>
+inline void Rows(DeinterlaceMode mode, T const *frame, T const *previous,
+                 T *out, long stride, long elements, long height, int field,
+                 long first, long last, Kernels const &kernels = best) {
+  auto const row = [&](auto *p, long y) { return p + y * stride; };
+  for (auto y = first; y < last; y++) {
+    if (y % 2 == field) {
+      std::memcpy(row(out, y), row(frame, y),
+                  static_cast<std::size_t>(elements) * sizeof(T));
+      continue;
+    }
+    // The field's own lines either side, mirrored at the edges
+    auto const above = y > 0 ? y - 1 : y + 1;
+    auto const below = y + 1 < height ? y + 1 : y - 1;
+    if (mode == DeinterlaceMode::Adaptive && previous != nullptr) {
+      // The first field's missing lines come from the previous frame's
+      // second field, the second field's from this frame's first
+      auto const weave = field == 0 ? row(previous, y) : row(frame, y);
+      if constexpr (sizeof(T) == 1) {
+        kernels.adapt8(row(frame, above), row(frame, below),
+                       row(previous, above), row(previous, below), weave,
+                       row(out, y), elements);
+      } else {
+        kernels.adapt16(row(frame, above), row(frame, below),
+                        row(previous, above), row(previous, below), weave,
+                        row(out, y), elements);
+      }
+    } else {
+      if constexpr (sizeof(T) == 1) {
+        kernels.interpolate8(row(frame, above), row(frame, below),
+                             row(out, y), elements);
+      } else {
+        kernels.interpolate16(row(frame, above), row(frame, below),
+                              row(out, y), elements);
+      }
+    }
+  }
+}
+
+} // namespace deinterlace
+
+// Deinterlaces on a shared worker pool, each field's picture split into bands
+// of rows
+class Deinterlacer {
+private:
+  // Rows per piece of work, even so every band starts on the first field
+  static constexpr auto bandRows = 64l;
+
+  DeinterlaceMode mode;
+  WorkerPool &workers;
+  BufferPool buffers;
+
+public:
+  Deinterlacer(DeinterlaceMode mode, WorkerPool &workers, bool hugePages)
+      : mode{mode}, workers{workers}, buffers{hugePages} {}
+
+  // The pictures at the time of the first and then the second field, null if
+  // there was no memory for them. previous is the frame before in the same
+  // format, or null.
+  auto run(FrameDescriptor const &descriptor, void const *frame,
+           void const *previous) -> std::array<PooledBuffer, 2> {
+    auto const size = deinterlace::FrameSize(descriptor);
+    auto out = std::array{Acquire(buffers, size), Acquire(buffers, size)};
+    if (out[0] == nullptr || out[1] == nullptr) {
+      return {};
+    }
+
+    auto const planes = deinterlace::Planes(descriptor);
+    auto const bands = (descriptor.height + bandRows - 1) / bandRows;
+    auto const pieces = static_cast<std::size_t>(2 * bands);
+    workers.parallelFor(pieces, [&](std::size_t piece) {
+      auto const field = static_cast<int>(piece % 2);
+      auto const first = static_cast<long>(piece / 2) * bandRows;
+      auto const last = std::min(first + bandRows, descriptor.height);
+      for (auto const &plane : planes) {
+        auto const at = [&](void const *p) {
+          return p == nullptr ? nullptr
+                              : static_cast<std::uint8_t const *>(p) +
+                                    plane.offset;
+        };
+        auto const to = static_cast<std::uint8_t *>(out[field].get()) +
+                        plane.offset;
+        if (plane.wide) {
+          deinterlace::Rows(
+              mode, reinterpret_cast<std::uint16_t const *>(at(frame)),
+              reinterpret_cast<std::uint16_t const *>(at(previous)),
+              reinterpret_cast<std::uint16_t *>(to), plane.stride / 2,
+              plane.elements, descriptor.height, field, first, last);
+        } else {
+          deinterlace::Rows(mode, at(frame), at(previous), to, plane.stride,
+                            plane.elements, descriptor.height, field, first,
+                            last);
+        }
+      }
+    });
+    return out;
+  }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+
+#include <ztd/out_ptr.hpp>
+
+#include "decklink.h"
+#include "events.h"
+
+// Identifies a device across removal and re-attachment, falling back to its
+// position on the bus where there is no persistent ID
+inline auto DeviceId(IDeckLink *deckLink) -> std::int64_t {
+  auto attributes = DeckLinkPtr<IDeckLinkProfileAttributes>{};
+  if (deckLink->QueryInterface(IID_IDeckLinkProfileAttributes,
+                               ztd::out_ptr::out_ptr(attributes)) != S_OK) {
+    return 0;
+  }
+  auto id = int64_t{0};
+  if (attributes->GetInt(BMDDeckLinkPersistentID, &id) == S_OK ||
+      attributes->GetInt(BMDDeckLinkTopologicalID, &id) == S_OK) {
+    return id;
+  }
+  return 0;
+}
+
+// Turns devices arriving and leaving into events. Every device present when
+// this is created arrives straight away.
+class DeviceDiscovery {
+private:
+  class Notifications : public ComObject<IDeckLinkDeviceNotificationCallback> {
+  private:
+    EventQueue &events;
+
+    void post(Event::Type type, IDeckLink *deckLink) {
+      deckLink->AddRef();
+      auto const id = DeviceId(deckLink);
+      events.post({type, MakeDeckLinkPtr(deckLink), id});
+    }
+
+  public:
+    explicit Notifications(EventQueue &events) : events{events} {}
+
+    auto DeckLinkDeviceArrived(IDeckLink *deckLink) -> HRESULT override {
+      post(Event::DeviceArrived, deckLink);
+      return S_OK;
+    }
+
+    auto DeckLinkDeviceRemoved(IDeckLink *deckLink) -> HRESULT override {
+      post(Event::DeviceRemoved, deckLink);
+      return S_OK;
+    }
+
+    auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+      if (IsIUnknown(iid) ||
+          SameIID(iid, IID_IDeckLinkDeviceNotificationCallback)) {
+        AddRef();
+        *ppv = this;
+        return S_OK;
+      }
+      *ppv = nullptr;
+      return E_NOINTERFACE;
+    }
+  };
+
+  DeckLinkPtr<IDeckLinkDiscovery> discovery;
+  DeckLinkPtr<Notifications> notifications;
+
+public:
+  explicit DeviceDiscovery(EventQueue &events)
+      : notifications{new Notifications{events}} {
+#if defined(UNIX)
+    discovery = MakeDeckLinkPtr(CreateDeckLinkDiscoveryInstance());
+#elif defined(WIN32)
+    IDeckLinkDiscovery *p = nullptr;
+    if (CoCreateInstance(CLSID_CDeckLinkDiscovery, nullptr, CLSCTX_ALL,
+                         IID_IDeckLinkDiscovery,
+                         reinterpret_cast<void **>(&p)) == S_OK) {
+      discovery = MakeDeckLinkPtr(p);
+    }
+#endif
+    if (discovery == nullptr ||
+        discovery->InstallDeviceNotifications(notifications.get()) != S_OK) {
+      std::cerr << "Could not watch for devices, they will not be recovered "
+                   "after removal\n";
+      discovery.reset();
+    }
+  }
+
+  DeviceDiscovery(DeviceDiscovery const &) = delete;
+  DeviceDiscovery &operator=(DeviceDiscovery const &) = delete;
+  DeviceDiscovery(DeviceDiscovery &&) = delete;
+  DeviceDiscovery &operator=(DeviceDiscovery &&) = delete;
+
+  ~DeviceDiscovery() {
+    if (discovery != nullptr) {
+      discovery->UninstallDeviceNotifications();
+    }
+  }
+};
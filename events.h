@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "decklink.h"
+
+#if defined(UNIX)
+#include <unistd.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif
+
+struct Event {
+  enum Type {
+    Shutdown,
+    DeviceArrived,
+    DeviceRemoved,
+    // SIGUSR1, print stats without stopping
+    DumpStats,
+    // --bench has warmed up, or finished
+    BenchStart,
+    BenchEnd,
+  };
+
+  Type type;
+  // For device events, the device and its persistent ID
+  DeckLinkPtr<IDeckLink> device = nullptr;
+  std::int64_t deviceId = 0;
+  std::chrono::steady_clock::time_point at = std::chrono::steady_clock::now();
+};
+
+// Things for the main thread to deal with, it sleeps until one arrives
+class EventQueue {
+private:
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<Event> events;
+
+public:
+  void post(Event event) {
+    {
+      auto const lock = std::scoped_lock{mutex};
+      events.push_back(std::move(event));
+    }
+    condition.notify_one();
+  }
+
+  auto wait() -> Event {
+    auto lock = std::unique_lock{mutex};
+    condition.wait(lock, [&] { return !events.empty(); });
+    auto event = std::move(events.front());
+    events.pop_front();
+    return event;
+  }
+};
+
+// Turns SIGINT, SIGTERM and SIGHUP (or console control events on Windows)
+// into shutdown events, and SIGUSR1 into a stats dump. Only one may exist at
+// a time.
+class SignalHandler {
+private:
+  static inline EventQueue *queue = nullptr;
+
+#if defined(UNIX)
+  static inline int pipeFds[2] = {-1, -1};
+  static constexpr int signals[] = {SIGINT, SIGTERM, SIGHUP, SIGUSR1};
+
+  std::jthread thread;
+
+  static void handle(int signal) {
+    auto const saved = errno;
+    auto const byte = static_cast<char>(signal);
+    [[maybe_unused]] auto const written = write(pipeFds[1], &byte, 1);
+    errno = saved;
+  }
+
+public:
+  explicit SignalHandler(EventQueue &events) {
+    queue = &events;
+    if (pipe(pipeFds) != 0) {
+      std::cerr << "Could not create signal pipe\n";
+      std::terminate();
+    }
+    thread = std::jthread{[](std::stop_token stop) {
+      auto byte = char{};
+      while (read(pipeFds[0], &byte, 1) == 1 && !stop.stop_requested()) {
+        queue->post({byte == SIGUSR1 ? Event::DumpStats : Event::Shutdown});
+      }
+    }};
+
+    struct sigaction action = {};
+    action.sa_handler = handle;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    for (auto const signal : signals) {
+      sigaction(signal, &action, nullptr);
+    }
+  }
+
+  ~SignalHandler() {
+    for (auto const signal : signals) {
+      std::signal(signal, SIG_DFL);
+    }
+    thread.request_stop();
+    auto const byte = char{};
+    [[maybe_unused]] auto const written = write(pipeFds[1], &byte, 1);
+    thread.join();
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    queue = nullptr;
+  }
+#elif defined(WIN32)
+  static auto WINAPI handle(DWORD) -> BOOL {
+    queue->post({Event::Shutdown});
+    return TRUE;
+  }
+
+public:
+  explicit SignalHandler(EventQueue &events) {
+    queue = &events;
+    SetConsoleCtrlHandler(handle, TRUE);
+  }
+
+  ~SignalHandler() {
+    SetConsoleCtrlHandler(handle, FALSE);
+    queue = nullptr;
+  }
+#endif
+
+  SignalHandler(SignalHandler const &) = delete;
+  SignalHandler &operator=(SignalHandler const &) = delete;
+  SignalHandler(SignalHandler &&) = delete;
+  SignalHandler &operator=(SignalHandler &&) = delete;
+};
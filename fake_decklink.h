@@ -0,0 +1,881 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "decklink.h"
+#include "options.h"
+
+// A stand-in for the DeckLink driver, so capture can be run and measured
+// without a card. Each input has its own clock thread delivering colour bars,
+// with the frame number in the first eight bytes, at the rate of whichever
+// display mode is enabled. Dropped frames, delivery jitter and format changes
+// can be injected. Frames fall due while a callback is slow to return, and are
+// counted as queued until they are delivered or flushed.
+//
+// Only capture is provided, and only on UNIX, where the interfaces share
+// their signatures.
+
+#if defined(UNIX)
+namespace fake {
+
+struct Mode {
+  BMDDisplayMode displayMode;
+  char const *name;
+  long width;
+  long height;
+  BMDTimeValue frameDuration;
+  BMDTimeScale timeScale;
+  BMDFieldDominance fieldDominance;
+};
+
+// Every mode in DeckLinkAPIModes.h
+inline constexpr Mode modes[] = {
+    {bmdModeNTSC, "NTSC", 720, 486, 1001, 30000, bmdLowerFieldFirst},
+    {bmdModeNTSC2398, "NTSC2398", 720, 486, 1001, 24000, bmdLowerFieldFirst},
+    {bmdModePAL, "PAL", 720, 576, 1000, 25000, bmdUpperFieldFirst},
+    {bmdModeNTSCp, "NTSCp", 720, 486, 1001, 60000, bmdProgressiveFrame},
+    {bmdModePALp, "PALp", 720, 576, 1000, 50000, bmdProgressiveFrame},
+    {bmdModeHD1080p2398, "HD1080p2398", 1920, 1080, 1001, 24000, bmdProgressiveFrame},
+    {bmdModeHD1080p24, "HD1080p24", 1920, 1080, 1000, 24000, bmdProgressiveFrame},
+    {bmdModeHD1080p25, "HD1080p25", 1920, 1080, 1000, 25000, bmdProgressiveFrame},
+    {bmdModeHD1080p2997, "HD1080p2997", 1920, 1080, 1001, 30000, bmdProgressiveFrame},
+    {bmdModeHD1080p30, "HD1080p30", 1920, 1080, 1000, 30000, bmdProgressiveFrame},
+    {bmdModeHD1080p4795, "HD1080p4795", 1920, 1080, 1001, 48000, bmdProgressiveFrame},
+    {bmdModeHD1080p48, "HD1080p48", 1920, 1080, 1000, 48000, bmdProgressiveFrame},
+    {bmdModeHD1080p50, "HD1080p50", 1920, 1080, 1000, 50000, bmdProgressiveFrame},
+    {bmdModeHD1080p5994, "HD1080p5994", 1920, 1080, 1001, 60000, bmdProgressiveFrame},
+    {bmdModeHD1080p6000, "HD1080p6000", 1920, 1080, 1000, 60000, bmdProgressiveFrame},
+    {bmdModeHD1080p9590, "HD1080p9590", 1920, 1080, 1001, 96000, bmdProgressiveFrame},
+    {bmdModeHD1080p96, "HD1080p96", 1920, 1080, 1000, 96000, bmdProgressiveFrame},
+    {bmdModeHD1080p100, "HD1080p100", 1920, 1080, 1000, 100000, bmdProgressiveFrame},
+    {bmdModeHD1080p11988, "HD1080p11988", 1920, 1080, 1001, 120000, bmdProgressiveFrame},
+    {bmdModeHD1080p120, "HD1080p120", 1920, 1080, 1000, 120000, bmdProgressiveFrame},
+    {bmdModeHD1080i50, "HD1080i50", 1920, 1080, 1000, 25000, bmdUpperFieldFirst},
+    {bmdModeHD1080i5994, "HD1080i5994", 1920, 1080, 1001, 30000, bmdUpperFieldFirst},
+    {bmdModeHD1080i6000, "HD1080i6000", 1920, 1080, 1000, 30000, bmdUpperFieldFirst},
+    {bmdModeHD720p50, "HD720p50", 1280, 720, 1000, 50000, bmdProgressiveFrame},
+    {bmdModeHD720p5994, "HD720p5994", 1280, 720, 1001, 60000, bmdProgressiveFrame},
+    {bmdModeHD720p60, "HD720p60", 1280, 720, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode2k2398, "2k2398", 2048, 1556, 1001, 24000, bmdProgressiveFrame},
+    {bmdMode2k24, "2k24", 2048, 1556, 1000, 24000, bmdProgressiveFrame},
+    {bmdMode2k25, "2k25", 2048, 1556, 1000, 25000, bmdProgressiveFrame},
+    {bmdMode2kDCI2398, "2kDCI2398", 2048, 1080, 1001, 24000, bmdProgressiveFrame},
+    {bmdMode2kDCI24, "2kDCI24", 2048, 1080, 1000, 24000, bmdProgressiveFrame},
+    {bmdMode2kDCI25, "2kDCI25", 2048, 1080, 1000, 25000, bmdProgressiveFrame},
+    {bmdMode2kDCI2997, "2kDCI2997", 2048, 1080, 1001, 30000, bmdProgressiveFrame},
+    {bmdMode2kDCI30, "2kDCI30", 2048, 1080, 1000, 30000, bmdProgressiveFrame},
+    {bmdMode2kDCI4795, "2kDCI4795", 2048, 1080, 1001, 48000, bmdProgressiveFrame},
+    {bmdMode2kDCI48, "2kDCI48", 2048, 1080, 1000, 48000, bmdProgressiveFrame},
+    {bmdMode2kDCI50, "2kDCI50", 2048, 1080, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode2kDCI5994, "2kDCI5994", 2048, 1080, 1001, 60000, bmdProgressiveFrame},
+    {bmdMode2kDCI60, "2kDCI60", 2048, 1080, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode2kDCI9590, "2kDCI9590", 2048, 1080, 1001, 96000, bmdProgressiveFrame},
+    {bmdMode2kDCI96, "2kDCI96", 2048, 1080, 1000, 96000, bmdProgressiveFrame},
+    {bmdMode2kDCI100, "2kDCI100", 2048, 1080, 1000, 100000, bmdProgressiveFrame},
+    {bmdMode2kDCI11988, "2kDCI11988", 2048, 1080, 1001, 120000, bmdProgressiveFrame},
+    {bmdMode2kDCI120, "2kDCI120", 2048, 1080, 1000, 120000, bmdProgressiveFrame},
+    {bmdMode4K2160p2398, "4K2160p2398", 3840, 2160, 1001, 24000, bmdProgressiveFrame},
+    {bmdMode4K2160p24, "4K2160p24", 3840, 2160, 1000, 24000, bmdProgressiveFrame},
+    {bmdMode4K2160p25, "4K2160p25", 3840, 2160, 1000, 25000, bmdProgressiveFrame},
+    {bmdMode4K2160p2997, "4K2160p2997", 3840, 2160, 1001, 30000, bmdProgressiveFrame},
+    {bmdMode4K2160p30, "4K2160p30", 3840, 2160, 1000, 30000, bmdProgressiveFrame},
+    {bmdMode4K2160p4795, "4K2160p4795", 3840, 2160, 1001, 48000, bmdProgressiveFrame},
+    {bmdMode4K2160p48, "4K2160p48", 3840, 2160, 1000, 48000, bmdProgressiveFrame},
+    {bmdMode4K2160p50, "4K2160p50", 3840, 2160, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode4K2160p5994, "4K2160p5994", 3840, 2160, 1001, 60000, bmdProgressiveFrame},
+    {bmdMode4K2160p60, "4K2160p60", 3840, 2160, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode4K2160p9590, "4K2160p9590", 3840, 2160, 1001, 96000, bmdProgressiveFrame},
+    {bmdMode4K2160p96, "4K2160p96", 3840, 2160, 1000, 96000, bmdProgressiveFrame},
+    {bmdMode4K2160p100, "4K2160p100", 3840, 2160, 1000, 100000, bmdProgressiveFrame},
+    {bmdMode4K2160p11988, "4K2160p11988", 3840, 2160, 1001, 120000, bmdProgressiveFrame},
+    {bmdMode4K2160p120, "4K2160p120", 3840, 2160, 1000, 120000, bmdProgressiveFrame},
+    {bmdMode4kDCI2398, "4kDCI2398", 4096, 2160, 1001, 24000, bmdProgressiveFrame},
+    {bmdMode4kDCI24, "4kDCI24", 4096, 2160, 1000, 24000, bmdProgressiveFrame},
+    {bmdMode4kDCI25, "4kDCI25", 4096, 2160, 1000, 25000, bmdProgressiveFrame},
+    {bmdMode4kDCI2997, "4kDCI2997", 4096, 2160, 1001, 30000, bmdProgressiveFrame},
+    {bmdMode4kDCI30, "4kDCI30", 4096, 2160, 1000, 30000, bmdProgressiveFrame},
+    {bmdMode4kDCI4795, "4kDCI4795", 4096, 2160, 1001, 48000, bmdProgressiveFrame},
+    {bmdMode4kDCI48, "4kDCI48", 4096, 2160, 1000, 48000, bmdProgressiveFrame},
+    {bmdMode4kDCI50, "4kDCI50", 4096, 2160, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode4kDCI5994, "4kDCI5994", 4096, 2160, 1001, 60000, bmdProgressiveFrame},
+    {bmdMode4kDCI60, "4kDCI60", 4096, 2160, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode4kDCI9590, "4kDCI9590", 4096, 2160, 1001, 96000, bmdProgressiveFrame},
+    {bmdMode4kDCI96, "4kDCI96", 4096, 2160, 1000, 96000, bmdProgressiveFrame},
+    {bmdMode4kDCI100, "4kDCI100", 4096, 2160, 1000, 100000, bmdProgressiveFrame},
+    {bmdMode4kDCI11988, "4kDCI11988", 4096, 2160, 1001, 120000, bmdProgressiveFrame},
+    {bmdMode4kDCI120, "4kDCI120", 4096, 2160, 1000, 120000, bmdProgressiveFrame},
+    {bmdMode8K4320p2398, "8K4320p2398", 7680, 4320, 1001, 24000, bmdProgressiveFrame},
+    {bmdMode8K4320p24, "8K4320p24", 7680, 4320, 1000, 24000, bmdProgressiveFrame},
+    {bmdMode8K4320p25, "8K4320p25", 7680, 4320, 1000, 25000, bmdProgressiveFrame},
+    {bmdMode8K4320p2997, "8K4320p2997", 7680, 4320, 1001, 30000, bmdProgressiveFrame},
+    {bmdMode8K4320p30, "8K4320p30", 7680, 4320, 1000, 30000, bmdProgressiveFrame},
+    {bmdMode8K4320p4795, "8K4320p4795", 7680, 4320, 1001, 48000, bmdProgressiveFrame},
+    {bmdMode8K4320p48, "8K4320p48", 7680, 4320, 1000, 48000, bmdProgressiveFrame},
+    {bmdMode8K4320p50, "8K4320p50", 7680, 4320, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode8K4320p5994, "8K4320p5994", 7680, 4320, 1001, 60000, bmdProgressiveFrame},
+    {bmdMode8K4320p60, "8K4320p60", 7680, 4320, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode8kDCI2398, "8kDCI2398", 8192, 4320, 1001, 24000, bmdProgressiveFrame},
+    {bmdMode8kDCI24, "8kDCI24", 8192, 4320, 1000, 24000, bmdProgressiveFrame},
+    {bmdMode8kDCI25, "8kDCI25", 8192, 4320, 1000, 25000, bmdProgressiveFrame},
+    {bmdMode8kDCI2997, "8kDCI2997", 8192, 4320, 1001, 30000, bmdProgressiveFrame},
+    {bmdMode8kDCI30, "8kDCI30", 8192, 4320, 1000, 30000, bmdProgressiveFrame},
+    {bmdMode8kDCI4795, "8kDCI4795", 8192, 4320, 1001, 48000, bmdProgressiveFrame},
+    {bmdMode8kDCI48, "8kDCI48", 8192, 4320, 1000, 48000, bmdProgressiveFrame},
+    {bmdMode8kDCI50, "8kDCI50", 8192, 4320, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode8kDCI5994, "8kDCI5994", 8192, 4320, 1001, 60000, bmdProgressiveFrame},
+    {bmdMode8kDCI60, "8kDCI60", 8192, 4320, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode640x480p60, "640x480p60", 640, 480, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode800x600p60, "800x600p60", 800, 600, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode1440x900p50, "1440x900p50", 1440, 900, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode1440x900p60, "1440x900p60", 1440, 900, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode1440x1080p50, "1440x1080p50", 1440, 1080, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode1440x1080p60, "1440x1080p60", 1440, 1080, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode1600x1200p50, "1600x1200p50", 1600, 1200, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode1600x1200p60, "1600x1200p60", 1600, 1200, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode1920x1200p50, "1920x1200p50", 1920, 1200, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode1920x1200p60, "1920x1200p60", 1920, 1200, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode1920x1440p50, "1920x1440p50", 1920, 1440, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode1920x1440p60, "1920x1440p60", 1920, 1440, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode2560x1440p50, "2560x1440p50", 2560, 1440, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode2560x1440p60, "2560x1440p60", 2560, 1440, 1000, 60000, bmdProgressiveFrame},
+    {bmdMode2560x1600p50, "2560x1600p50", 2560, 1600, 1000, 50000, bmdProgressiveFrame},
+    {bmdMode2560x1600p60, "2560x1600p60", 2560, 1600, 1000, 60000, bmdProgressiveFrame},
+};
+
+inline auto FindMode(BMDDisplayMode displayMode) -> Mode const * {
+  for (auto const &mode : modes) {
+    if (mode.displayMode == displayMode) {
+      return &mode;
+    }
+  }
+  return nullptr;
+}
+
+// Format changes step through these
+inline constexpr BMDDisplayMode formatCycle[] = {
+    bmdModeHD1080p25,
+    bmdModeHD720p50,
+    bmdModeHD1080i5994,
+    bmdModeHD1080p5994,
+};
+
+// Strings handed out through the API belong to the caller
+inline auto ApiString(char const *s) -> decltype(DLString::data) {
+#if defined(__APPLE__) && defined(__MACH__)
+  return CFStringCreateWithCString(nullptr, s, kCFStringEncodingUTF8);
+#else
+  return strdup(s);
+#endif
+}
+
+template <typename Interface>
+auto Query(Interface *self, REFIID iid, REFIID own, LPVOID *ppv) -> HRESULT {
+  if (IsIUnknown(iid) || SameIID(iid, own)) {
+    self->AddRef();
+    *ppv = self;
+    return S_OK;
+  }
+  *ppv = nullptr;
+  return E_NOINTERFACE;
+}
+
+class DisplayMode : public ComObject<IDeckLinkDisplayMode> {
+private:
+  Mode const &mode;
+
+public:
+  explicit DisplayMode(Mode const &mode) : mode{mode} {}
+
+  auto GetName(decltype(DLString::data) *name) -> HRESULT override {
+    *name = ApiString(mode.name);
+    return S_OK;
+  }
+  auto GetDisplayMode() -> BMDDisplayMode override { return mode.displayMode; }
+  auto GetWidth() -> long override { return mode.width; }
+  auto GetHeight() -> long override { return mode.height; }
+  auto GetFrameRate(BMDTimeValue *frameDuration, BMDTimeScale *timeScale)
+      -> HRESULT override {
+    *frameDuration = mode.frameDuration;
+    *timeScale = mode.timeScale;
+    return S_OK;
+  }
+  auto GetFieldDominance() -> BMDFieldDominance override {
+    return mode.fieldDominance;
+  }
+  auto GetFlags() -> BMDDisplayModeFlags override { return 0; }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    return Query<IDeckLinkDisplayMode>(this, iid, IID_IDeckLinkDisplayMode,
+                                       ppv);
+  }
+};
+
+class DisplayModeIterator : public ComObject<IDeckLinkDisplayModeIterator> {
+private:
+  std::size_t next = 0;
+
+public:
+  auto Next(IDeckLinkDisplayMode **displayMode) -> HRESULT override {
+    if (next == std::size(modes)) {
+      *displayMode = nullptr;
+      return S_FALSE;
+    }
+    *displayMode = new DisplayMode{modes[next++]};
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    return Query<IDeckLinkDisplayModeIterator>(
+        this, iid, IID_IDeckLinkDisplayModeIterator, ppv);
+  }
+};
+
+// 75% colour bars, white to black
+struct Bar {
+  std::uint8_t y, cb, cr;
+  std::uint8_t r, g, b;
+};
+
+inline constexpr Bar bars[] = {
+    {180, 128, 128, 191, 191, 191}, {168, 44, 136, 191, 191, 0},
+    {145, 147, 44, 0, 191, 191},    {133, 63, 52, 0, 191, 0},
+    {63, 193, 204, 191, 0, 191},    {51, 109, 212, 191, 0, 0},
+    {28, 212, 120, 0, 0, 191},      {16, 128, 128, 0, 0, 0},
+};
+
+inline auto Bars(long width, long height, BMDPixelFormat pixelFormat)
+    -> std::vector<std::uint8_t> {
+  auto const rowBytes = RowBytes(pixelFormat, width);
+  auto row = std::vector<std::uint8_t>(rowBytes);
+  auto bar = [&](long x) -> Bar const & { return bars[x * 8 / width]; };
+  switch (pixelFormat) {
+  case bmdFormat8BitYUV:
+    for (auto x = 0l; x + 1 < width; x += 2) {
+      auto const &b = bar(x);
+      row[x * 2 + 0] = b.cb;
+      row[x * 2 + 1] = b.y;
+      row[x * 2 + 2] = b.cr;
+      row[x * 2 + 3] = b.y;
+    }
+    break;
+  case bmdFormat8BitBGRA:
+    for (auto x = 0l; x < width; x++) {
+      auto const &b = bar(x);
+      row[x * 4 + 0] = b.b;
+      row[x * 4 + 1] = b.g;
+      row[x * 4 + 2] = b.r;
+      row[x * 4 + 3] = 255;
+    }
+    break;
+  case bmdFormat10BitYUV:
+    // Six pixels in four little endian words, Cb Y Cr Y Cb Y Cr Y Cb Y Cr Y
+    for (auto x = 0l; x < width; x += 6) {
+      std::uint32_t samples[12];
+      for (auto i = 0; i < 6; i++) {
+        auto const &b = bar(std::min(x + i, width - 1));
+        samples[i * 2 + 1] = b.y * 4u;
+        samples[i * 2] = (i % 2 == 0 ? b.cb : b.cr) * 4u;
+      }
+      for (auto w = 0; w < 4; w++) {
+        auto const word = samples[w * 3] | samples[w * 3 + 1] << 10 |
+                          samples[w * 3 + 2] << 20;
+        std::memcpy(row.data() + x / 6 * 16 + w * 4, &word, 4);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+  auto frame = std::vector<std::uint8_t>(rowBytes * height);
+  for (auto y = 0l; y < height; y++) {
+    std::copy(row.begin(), row.end(), frame.begin() + y * rowBytes);
+  }
+  return frame;
+}
+
+class VideoFrame : public ComObject<IDeckLinkVideoInputFrame> {
+private:
+  DeckLinkPtr<IDeckLinkMemoryAllocator> allocator;
+  void *buffer;
+  long width;
+  long height;
+  long rowBytes;
+  BMDPixelFormat pixelFormat;
+  BMDTimeValue streamTime;
+  BMDTimeValue duration;
+  BMDTimeScale timeScale;
+  std::chrono::nanoseconds hardwareTime;
+
+  static auto Rescale(BMDTimeValue value, BMDTimeScale from, BMDTimeScale to) {
+    return static_cast<BMDTimeValue>(static_cast<__int128>(value) * to / from);
+  }
+
+protected:
+  ~VideoFrame() override {
+    if (allocator != nullptr) {
+      allocator->ReleaseBuffer(buffer);
+    } else {
+      std::free(buffer);
+    }
+  }
+
+public:
+  VideoFrame(DeckLinkPtr<IDeckLinkMemoryAllocator> allocator, void *buffer,
+             long width, long height, BMDPixelFormat pixelFormat,
+             BMDTimeValue streamTime, BMDTimeValue duration,
+             BMDTimeScale timeScale, std::chrono::nanoseconds hardwareTime)
+      : allocator{std::move(allocator)}, buffer{buffer}, width{width},
+        height{height}, rowBytes{RowBytes(pixelFormat, width)},
+        pixelFormat{pixelFormat}, streamTime{streamTime}, duration{duration},
+        timeScale{timeScale}, hardwareTime{hardwareTime} {}
+
+  auto GetWidth() -> long override { return width; }
+  auto GetHeight() -> long override { return height; }
+  auto GetRowBytes() -> long override { return rowBytes; }
+  auto GetPixelFormat() -> BMDPixelFormat override { return pixelFormat; }
+  auto GetFlags() -> BMDFrameFlags override { return bmdFrameFlagDefault; }
+  auto GetBytes(void **data) -> HRESULT override {
+    *data = buffer;
+    return S_OK;
+  }
+  auto GetTimecode(BMDTimecodeFormat, IDeckLinkTimecode **timecode)
+      -> HRESULT override {
+    *timecode = nullptr;
+    return S_FALSE;
+  }
+  auto GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary)
+      -> HRESULT override {
+    *ancillary = nullptr;
+    return S_FALSE;
+  }
+
+  auto GetStreamTime(BMDTimeValue *frameTime, BMDTimeValue *frameDuration,
+                     BMDTimeScale scale) -> HRESULT override {
+    *frameTime = Rescale(streamTime, timeScale, scale);
+    *frameDuration = Rescale(duration, timeScale, scale);
+    return S_OK;
+  }
+
+  auto GetHardwareReferenceTimestamp(BMDTimeScale scale,
+                                     BMDTimeValue *frameTime,
+                                     BMDTimeValue *frameDuration)
+      -> HRESULT override {
+    *frameTime = Rescale(hardwareTime.count(), 1'000'000'000, scale);
+    *frameDuration = Rescale(duration, timeScale, scale);
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    if (SameIID(iid, IID_IDeckLinkVideoFrame)) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoFrame *>(this);
+      return S_OK;
+    }
+    return Query<IDeckLinkVideoInputFrame>(this, iid,
+                                           IID_IDeckLinkVideoInputFrame, ppv);
+  }
+};
+
+// A 1kHz tone at -20dBFS, exactly 48 samples a cycle at 48kHz
+class AudioPacket : public ComObject<IDeckLinkAudioInputPacket> {
+private:
+  std::vector<std::uint8_t> samples;
+  long frames;
+  BMDTimeValue packetTime;
+
+public:
+  AudioPacket(std::uint64_t first, long frames, int channels,
+              BMDAudioSampleType sampleType)
+      : samples(static_cast<std::size_t>(frames) * channels * sampleType / 8),
+        frames{frames},
+        packetTime{static_cast<BMDTimeValue>(first)} {
+    auto const pi = std::acos(-1.0);
+    for (auto i = 0l; i < frames; i++) {
+      auto const level =
+          0.1 * std::sin(2 * pi * static_cast<double>((first + i) % 48) / 48);
+      for (auto c = 0; c < channels; c++) {
+        auto const at = (i * channels + c) * sampleType / 8;
+        if (sampleType == bmdAudioSampleType16bitInteger) {
+          auto const s = static_cast<std::int16_t>(level * 32767);
+          std::memcpy(samples.data() + at, &s, sizeof(s));
+        } else {
+          auto const s = static_cast<std::int32_t>(level * 2147483647.0);
+          std::memcpy(samples.data() + at, &s, sizeof(s));
+        }
+      }
+    }
+  }
+
+  auto GetSampleFrameCount() -> long override { return frames; }
+  auto GetBytes(void **buffer) -> HRESULT override {
+    *buffer = samples.data();
+    return S_OK;
+  }
+  auto GetPacketTime(BMDTimeValue *time, BMDTimeScale timeScale)
+      -> HRESULT override {
+    *time = packetTime * timeScale / bmdAudioSampleRate48kHz;
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    return Query<IDeckLinkAudioInputPacket>(
+        this, iid, IID_IDeckLinkAudioInputPacket, ppv);
+  }
+};
+
+class Input : public ComObject<IDeckLinkInput> {
+private:
+  Options const &options;
+  std::chrono::steady_clock::time_point epoch =
+      std::chrono::steady_clock::now();
+
+  // Shared between the API and the clock thread. Callbacks are made without
+  // holding it, as they call straight back in.
+  std::mutex mutex;
+  Mode const *mode = nullptr;
+  BMDPixelFormat pixelFormat = bmdFormat8BitYUV;
+  BMDVideoInputFlags flags = bmdVideoInputFlagDefault;
+  bool videoEnabled = false;
+  int audioChannels = 0;
+  BMDAudioSampleType audioSampleType = bmdAudioSampleType16bitInteger;
+  bool streaming = false;
+  DeckLinkPtr<IDeckLinkInputCallback> callback;
+  DeckLinkPtr<IDeckLinkMemoryAllocator> allocator;
+  std::map<std::pair<BMDDisplayMode, BMDPixelFormat>,
+           std::vector<std::uint8_t>>
+      patterns;
+
+  // Frames already due while a callback held the clock up, which a driver
+  // would have queued, and how many of them are to be thrown away, by a
+  // flush or for want of buffers. The driver has buffers for queueFrames.
+  static constexpr auto queueFrames = std::uint32_t{32};
+  std::atomic<std::uint32_t> backlog = 0;
+  std::atomic<std::uint32_t> flushing = 0;
+
+  std::jthread clock;
+
+  auto pattern(Mode const &mode) -> std::vector<std::uint8_t> const & {
+    auto &p = patterns[{mode.displayMode, pixelFormat}];
+    if (p.empty()) {
+      p = Bars(mode.width, mode.height, pixelFormat);
+    }
+    return p;
+  }
+
+  void run(std::stop_token stop) {
+    auto random = std::mt19937{std::random_device{}()};
+    auto percent = std::uniform_real_distribution<double>{0, 100};
+    auto jitter = std::uniform_int_distribution<long>{
+        0, static_cast<long>(options.fakeJitter.count())};
+
+    auto frameNumber = std::uint64_t{0};
+    auto streamTime = BMDTimeValue{0};
+    auto audioSamples = std::uint64_t{0};
+    // Samples per frame are rarely whole, the remainder carries over
+    auto audioOwed = BMDTimeValue{0};
+    auto previous = BMDDisplayMode{};
+    auto due = std::chrono::steady_clock::now();
+    auto nextFormatChange = due + options.fakeFormatChange;
+
+    while (!stop.stop_requested()) {
+      auto lock = std::unique_lock{mutex};
+      if (mode == nullptr) {
+        return;
+      }
+      auto const current = *mode;
+      auto const duration = std::chrono::nanoseconds{
+          current.frameDuration * 1'000'000'000 / current.timeScale};
+      lock.unlock();
+
+      due += duration;
+      std::this_thread::sleep_until(due +
+                                    std::chrono::microseconds{jitter(random)});
+      auto const hardwareTime = due - epoch;
+      auto const behind = static_cast<std::uint32_t>(
+          std::max(std::chrono::steady_clock::duration::rep{0},
+                   (std::chrono::steady_clock::now() - due) / duration));
+      backlog.store(std::min(behind, queueFrames), std::memory_order_relaxed);
+      if (behind > queueFrames &&
+          flushing.load(std::memory_order_relaxed) < behind - queueFrames) {
+        // Out of buffers, the oldest frames are lost
+        flushing.store(behind - queueFrames, std::memory_order_relaxed);
+      }
+
+      lock.lock();
+      if (!streaming || !videoEnabled || callback == nullptr) {
+        continue;
+      }
+      auto const target = callback.get();
+      target->AddRef();
+      auto const client = MakeDeckLinkPtr(target);
+
+      if (options.fakeFormatChange.count() > 0 && due >= nextFormatChange) {
+        nextFormatChange = due + options.fakeFormatChange;
+        if (flags & bmdVideoInputEnableFormatDetection) {
+          auto const next = [&] {
+            auto const it = std::find(std::begin(formatCycle),
+                                      std::end(formatCycle), mode->displayMode);
+            return it == std::end(formatCycle) ||
+                           it + 1 == std::end(formatCycle)
+                       ? formatCycle[0]
+                       : it[1];
+          }();
+          lock.unlock();
+          auto const newMode =
+              DeckLinkPtr<IDeckLinkDisplayMode>{new DisplayMode{*FindMode(next)}};
+          client->VideoInputFormatChanged(
+              bmdVideoInputDisplayModeChanged |
+                  bmdVideoInputFieldDominanceChanged,
+              newMode.get(),
+              bmdDetectedVideoInputYCbCr422 | bmdDetectedVideoInput8BitDepth);
+          continue;
+        }
+      }
+
+      if (current.displayMode != previous) {
+        // Stream time is in the mode's own time scale
+        previous = current.displayMode;
+        streamTime = 0;
+        audioOwed = 0;
+      }
+      auto const number = frameNumber++;
+      auto const time = streamTime;
+      streamTime += current.frameDuration;
+      audioOwed += bmdAudioSampleRate48kHz * current.frameDuration;
+      auto const audioFirst = audioSamples;
+      audioSamples += static_cast<std::uint64_t>(audioOwed / current.timeScale);
+      audioOwed %= current.timeScale;
+      if (percent(random) < options.fakeDropPercent) {
+        continue;
+      }
+      if (flushing.load(std::memory_order_relaxed) > 0) {
+        flushing.fetch_sub(1, std::memory_order_relaxed);
+        continue;
+      }
+
+      auto const &bars = pattern(current);
+      void *buffer = nullptr;
+      if (allocator != nullptr) {
+        allocator->AllocateBuffer(static_cast<uint32_t>(bars.size()), &buffer);
+      } else {
+        buffer = std::malloc(bars.size());
+      }
+      if (buffer == nullptr) {
+        continue;
+      }
+      std::memcpy(buffer, bars.data(), bars.size());
+      std::memcpy(buffer, &number, sizeof(number));
+
+      if (allocator != nullptr) {
+        allocator->AddRef();
+      }
+      auto const frame = DeckLinkPtr<VideoFrame>{new VideoFrame{
+          MakeDeckLinkPtr(allocator.get()), buffer, current.width,
+          current.height, pixelFormat, time, current.frameDuration,
+          current.timeScale, hardwareTime}};
+      auto const audio =
+          audioChannels > 0
+              ? DeckLinkPtr<AudioPacket>{new AudioPacket{
+                    audioFirst, static_cast<long>(audioSamples - audioFirst),
+                    audioChannels, audioSampleType}}
+              : nullptr;
+      lock.unlock();
+
+      client->VideoInputFrameArrived(frame.get(), audio.get());
+    }
+  }
+
+public:
+  explicit Input(Options const &options) : options{options} {}
+
+  ~Input() override { StopStreams(); }
+
+  auto DoesSupportVideoMode(BMDVideoConnection, BMDDisplayMode requestedMode,
+                            BMDPixelFormat requestedPixelFormat,
+                            BMDVideoInputConversionMode,
+                            BMDSupportedVideoModeFlags,
+                            BMDDisplayMode *actualMode, bool *supported)
+      -> HRESULT override {
+    *supported = FindMode(requestedMode) != nullptr &&
+                 (requestedPixelFormat == bmdFormat8BitYUV ||
+                  requestedPixelFormat == bmdFormat10BitYUV ||
+                  requestedPixelFormat == bmdFormat8BitBGRA);
+    if (actualMode != nullptr) {
+      *actualMode = requestedMode;
+    }
+    return S_OK;
+  }
+
+  auto GetDisplayMode(BMDDisplayMode displayMode,
+                      IDeckLinkDisplayMode **result) -> HRESULT override {
+    auto const mode = FindMode(displayMode);
+    *result = mode != nullptr ? new DisplayMode{*mode} : nullptr;
+    return mode != nullptr ? S_OK : E_INVALIDARG;
+  }
+
+  auto GetDisplayModeIterator(IDeckLinkDisplayModeIterator **iterator)
+      -> HRESULT override {
+    *iterator = new DisplayModeIterator{};
+    return S_OK;
+  }
+
+  auto SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback *)
+      -> HRESULT override {
+    return E_NOTIMPL;
+  }
+
+  auto EnableVideoInput(BMDDisplayMode displayMode,
+                        BMDPixelFormat newPixelFormat,
+                        BMDVideoInputFlags newFlags) -> HRESULT override {
+    auto const newMode = FindMode(displayMode);
+    if (newMode == nullptr) {
+      return E_INVALIDARG;
+    }
+    auto const lock = std::scoped_lock{mutex};
+    mode = newMode;
+    pixelFormat = newPixelFormat;
+    flags = newFlags;
+    videoEnabled = true;
+    return S_OK;
+  }
+
+  auto DisableVideoInput() -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    videoEnabled = false;
+    return S_OK;
+  }
+
+  auto GetAvailableVideoFrameCount(uint32_t *count) -> HRESULT override {
+    *count = backlog.load(std::memory_order_relaxed);
+    return S_OK;
+  }
+
+  auto SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator *newAllocator)
+      -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    if (newAllocator != nullptr) {
+      newAllocator->AddRef();
+    }
+    allocator = MakeDeckLinkPtr(newAllocator);
+    return S_OK;
+  }
+
+  auto EnableAudioInput(BMDAudioSampleRate sampleRate,
+                        BMDAudioSampleType sampleType, uint32_t channelCount)
+      -> HRESULT override {
+    if (sampleRate != bmdAudioSampleRate48kHz) {
+      return E_INVALIDARG;
+    }
+    auto const lock = std::scoped_lock{mutex};
+    audioChannels = static_cast<int>(channelCount);
+    audioSampleType = sampleType;
+    return S_OK;
+  }
+
+  auto DisableAudioInput() -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    audioChannels = 0;
+    return S_OK;
+  }
+
+  auto GetAvailableAudioSampleFrameCount(uint32_t *count) -> HRESULT override {
+    *count = 0;
+    return S_OK;
+  }
+
+  auto StartStreams() -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    if (!videoEnabled) {
+      return E_FAIL;
+    }
+    if (!streaming && allocator != nullptr && !clock.joinable()) {
+      allocator->Commit();
+    }
+    streaming = true;
+    if (!clock.joinable()) {
+      clock = std::jthread{[this](std::stop_token stop) { run(stop); }};
+    }
+    return S_OK;
+  }
+
+  auto StopStreams() -> HRESULT override {
+    {
+      auto const lock = std::scoped_lock{mutex};
+      streaming = false;
+    }
+    if (clock.joinable() && clock.get_id() != std::this_thread::get_id()) {
+      clock.request_stop();
+      clock.join();
+      clock = {};
+      auto const lock = std::scoped_lock{mutex};
+      if (allocator != nullptr) {
+        allocator->Decommit();
+      }
+    }
+    return S_OK;
+  }
+
+  auto PauseStreams() -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    streaming = false;
+    return S_OK;
+  }
+
+  auto FlushStreams() -> HRESULT override {
+    flushing.store(backlog.exchange(0, std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+    return S_OK;
+  }
+
+  auto SetCallback(IDeckLinkInputCallback *newCallback) -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    if (newCallback != nullptr) {
+      newCallback->AddRef();
+    }
+    callback = MakeDeckLinkPtr(newCallback);
+    return S_OK;
+  }
+
+  auto GetHardwareReferenceClock(BMDTimeScale timeScale,
+                                 BMDTimeValue *hardwareTime,
+                                 BMDTimeValue *timeInFrame,
+                                 BMDTimeValue *ticksPerFrame)
+      -> HRESULT override {
+    auto const lock = std::scoped_lock{mutex};
+    if (mode == nullptr) {
+      return E_FAIL;
+    }
+    auto const now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - epoch)
+                         .count();
+    auto const frame = mode->frameDuration * timeScale / mode->timeScale;
+    *hardwareTime = now * timeScale / 1'000'000'000;
+    *ticksPerFrame = frame;
+    *timeInFrame = *hardwareTime % frame;
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    return Query<IDeckLinkInput>(this, iid, IID_IDeckLinkInput, ppv);
+  }
+};
+
+class Attributes : public ComObject<IDeckLinkProfileAttributes> {
+private:
+  std::int64_t id;
+
+public:
+  explicit Attributes(std::int64_t id) : id{id} {}
+
+  auto GetFlag(BMDDeckLinkAttributeID attribute, bool *value)
+      -> HRESULT override {
+    if (attribute == BMDDeckLinkSupportsInputFormatDetection) {
+      *value = true;
+      return S_OK;
+    }
+    return E_INVALIDARG;
+  }
+
+  auto GetInt(BMDDeckLinkAttributeID attribute, int64_t *value)
+      -> HRESULT override {
+    if (attribute == BMDDeckLinkPersistentID ||
+        attribute == BMDDeckLinkTopologicalID) {
+      *value = id;
+      return S_OK;
+    }
+    return E_INVALIDARG;
+  }
+
+  auto GetFloat(BMDDeckLinkAttributeID, double *) -> HRESULT override {
+    return E_INVALIDARG;
+  }
+
+  auto GetString(BMDDeckLinkAttributeID, decltype(DLString::data) *)
+      -> HRESULT override {
+    return E_INVALIDARG;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    return Query<IDeckLinkProfileAttributes>(
+        this, iid, IID_IDeckLinkProfileAttributes, ppv);
+  }
+};
+
+class DeckLink : public ComObject<IDeckLink> {
+private:
+  std::string name;
+  DeckLinkPtr<Input> input;
+  DeckLinkPtr<Attributes> attributes;
+
+public:
+  DeckLink(std::size_t index, Options const &options)
+      : name{"Fake DeckLink (" + std::to_string(index + 1) + ")"},
+        input{new Input{options}},
+        attributes{new Attributes{static_cast<std::int64_t>(0xFA4E0000 + index)}} {}
+
+  auto GetModelName(decltype(DLString::data) *modelName) -> HRESULT override {
+    *modelName = ApiString("Fake DeckLink");
+    return S_OK;
+  }
+
+  auto GetDisplayName(decltype(DLString::data) *displayName)
+      -> HRESULT override {
+    *displayName = ApiString(name.c_str());
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    if (SameIID(iid, IID_IDeckLinkInput)) {
+      return input->QueryInterface(iid, ppv);
+    }
+    if (SameIID(iid, IID_IDeckLinkProfileAttributes)) {
+      return attributes->QueryInterface(iid, ppv);
+    }
+    return Query<IDeckLink>(this, iid, IID_IDeckLink, ppv);
+  }
+};
+
+class Iterator : public ComObject<IDeckLinkIterator> {
+private:
+  std::vector<DeckLinkPtr<DeckLink>> deckLinks;
+  std::size_t next = 0;
+
+public:
+  explicit Iterator(Options const &options) {
+    for (auto i = std::size_t{0}; i < options.fakeDevices; i++) {
+      deckLinks.push_back(DeckLinkPtr<DeckLink>{new DeckLink{i, options}});
+    }
+  }
+
+  auto Next(IDeckLink **deckLink) -> HRESULT override {
+    if (next == deckLinks.size()) {
+      *deckLink = nullptr;
+      return S_FALSE;
+    }
+    auto const result = deckLinks[next++].get();
+    result->AddRef();
+    *deckLink = result;
+    return S_OK;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    return Query<IDeckLinkIterator>(this, iid, IID_IDeckLinkIterator, ppv);
+  }
+};
+
+} // namespace fake
+#endif
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Processing.NDI.Lib.h>
+
+#include "decklink.h"
+
+// Everything about a frame that only changes with the input format, worked
+// out once per format rather than once per frame
+struct FrameDescriptor {
+  BMDDisplayMode displayMode;
+  BMDPixelFormat pixelFormat;
+  long width;
+  long height;
+  long rowBytes;
+  int frameRateN;
+  int frameRateD;
+  NDIlib_frame_format_type_e frameFormat;
+  NDIlib_FourCC_video_type_e fourCC;
+  int lineStride;
+  // Fields captured at different times, rather than progressive segmented
+  bool interlaced;
+  // Moved down a line to make it upper field first, see fields.h
+  bool lowerFieldFirst;
+  // Zero for frames sent as captured
+  std::size_t convertedSize;
+};
+
+inline auto Describe(IDeckLinkDisplayMode *displayMode,
+                     BMDPixelFormat pixelFormat) -> FrameDescriptor {
+  BMDTimeValue fps_value;
+  BMDTimeScale fps_scale;
+  displayMode->GetFrameRate(&fps_value, &fps_scale);
+
+  auto format = [&] {
+    switch (displayMode->GetFieldDominance()) {
+      case bmdUnknownFieldDominance:
+        std::cerr << "Unknown field dominance\n";
+        std::terminate();
+      case bmdLowerFieldFirst:
+      case bmdUpperFieldFirst:
+        return NDIlib_frame_format_type_interleaved;
+      case bmdProgressiveFrame:
+        return NDIlib_frame_format_type_progressive;
+      case bmdProgressiveSegmentedFrame:
+        return NDIlib_frame_format_type_interleaved;
+      default:
+        std::cerr << "Unknown enum case\n";
+        std::terminate();
+    }
+  }();
+
+  auto const width = displayMode->GetWidth();
+  auto const height = displayMode->GetHeight();
+  auto const rowBytes = RowBytes(pixelFormat, width);
+  auto const tenBit = pixelFormat == bmdFormat10BitYUV;
+  auto const lowerFieldFirst =
+      displayMode->GetFieldDominance() == bmdLowerFieldFirst;
+  auto const fourCC = [&] {
+    switch (pixelFormat) {
+    case bmdFormat10BitYUV:
+      return NDIlib_FourCC_type_P216;
+    case bmdFormat8BitBGRA:
+      return NDIlib_FourCC_type_BGRX;
+    default:
+      return NDIlib_FourCC_type_UYVY;
+    }
+  }();
+
+  return {
+      displayMode->GetDisplayMode(),
+      pixelFormat,
+      width,
+      height,
+      rowBytes,
+      static_cast<int>(fps_scale),
+      static_cast<int>(fps_value),
+      format,
+      fourCC,
+      static_cast<int>(tenBit ? width * 2 : rowBytes),
+      lowerFieldFirst ||
+          displayMode->GetFieldDominance() == bmdUpperFieldFirst,
+      lowerFieldFirst,
+      tenBit            ? static_cast<std::size_t>(width) * height * 4
+      : lowerFieldFirst ? static_cast<std::size_t>(rowBytes) * height
+                        : 0,
+  };
+}
+
+// data is either the captured frame or its converted copy
+inline auto MakeNdiFrame(FrameDescriptor const &descriptor, void *data,
+                         std::int64_t timecode) {
+  return NDIlib_video_frame_v2_t(
+      descriptor.width, descriptor.height, descriptor.fourCC,
+      descriptor.frameRateN, descriptor.frameRateD, 0.0f,
+      descriptor.frameFormat, timecode, static_cast<uint8_t *>(data),
+      descriptor.lineStride);
+}
+
+// The descriptor for the current input format. Descriptors are kept for the
+// life of the stream, so a frame can carry a plain pointer to the one it was
+// captured with even after the format changes.
+class FrameDescriptors {
+private:
+  std::mutex mutex;
+  std::vector<std::unique_ptr<FrameDescriptor const>> cache;
+  std::atomic<FrameDescriptor const *> current = nullptr;
+
+public:
+  void select(IDeckLinkDisplayMode *displayMode, BMDPixelFormat pixelFormat) {
+    auto const lock = std::scoped_lock{mutex};
+    auto const mode = displayMode->GetDisplayMode();
+    for (auto const &descriptor : cache) {
+      if (descriptor->displayMode == mode &&
+          descriptor->pixelFormat == pixelFormat) {
+        current.store(descriptor.get(), std::memory_order_release);
+        return;
+      }
+    }
+    cache.push_back(std::make_unique<FrameDescriptor const>(
+        Describe(displayMode, pixelFormat)));
+    current.store(cache.back().get(), std::memory_order_release);
+  }
+
+  auto get() const { return current.load(std::memory_order_acquire); }
+};
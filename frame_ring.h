@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <semaphore>
+#include <vector>
+
+#include "decklink.h"
+#include "frame_descriptor.h"
+
+// A captured frame or packet, shared by every sink it was given to and handed
+// back to the driver when the last of them lets go
+using FrameHandle = DeckLinkRef<IDeckLinkVideoInputFrame>;
+using AudioHandle = DeckLinkRef<IDeckLinkAudioInputPacket>;
+
+// Keeps captured frames alive from arrival until a sink has finished with
+// them. NDI may read an async frame until the next frame is submitted, so a
+// frame is only let go once a later frame has been sent or the sender has been
+// flushed. Audio is sent synchronously, so a packet is let go as soon as it
+// has been submitted.
+//
+// Every sink has a ring of its own, so a full ring only costs that sink the
+// frame. A ring may be told to mark frames stale once enough newer ones are
+// queued behind them, for the sink to drop. One thread pushes and another
+// submits, and only a pusher asking to wait for room ever blocks.
+class FrameRing {
+public:
+  // Either of frame and audio may be missing, but not both
+  struct Pending {
+    IDeckLinkVideoInputFrame *frame;
+    IDeckLinkAudioInputPacket *audio;
+    FrameDescriptor const *descriptor;
+    std::int64_t frameTimecode;
+    std::int64_t audioTimecode;
+    std::chrono::steady_clock::time_point arrivedAt;
+    std::chrono::steady_clock::time_point pushedAt;
+    // Enough frames have been queued since for it to be dropped, see drop()
+    bool stale;
+
+    explicit operator bool() const {
+      return frame != nullptr || audio != nullptr;
+    }
+  };
+
+private:
+  struct Slot {
+    FrameHandle frame;
+    AudioHandle audio;
+    FrameDescriptor const *descriptor;
+    std::int64_t frameTimecode;
+    std::int64_t audioTimecode;
+    std::chrono::steady_clock::time_point arrivedAt;
+    std::chrono::steady_clock::time_point pushedAt;
+  };
+
+  std::vector<Slot> slots;
+  std::size_t limit;
+  std::size_t staleAt;
+
+  alignas(64) std::atomic<std::uint64_t> pushed = 0;
+  alignas(64) std::atomic<std::uint64_t> submitted = 0;
+  std::atomic<std::uint64_t> released = 0;
+  std::uint64_t lastVideo = 0;
+  alignas(64) std::atomic<std::uint32_t> wakeups = 0;
+  // Set by a producer waiting for room, which the consumer then signals
+  alignas(64) std::atomic<bool> roomWanted = false;
+  std::counting_semaphore<> roomMade{0};
+
+  auto slot(std::uint64_t i) -> auto & { return slots[i % slots.size()]; }
+
+  void releaseUntil(std::uint64_t end) {
+    auto const start = released.load(std::memory_order_relaxed);
+    auto i = start;
+    for (; i < end; i++) {
+      slot(i).frame.reset();
+    }
+    released.store(i, std::memory_order_release);
+    if (i == start) {
+      return;
+    }
+    // Pairs with the fence in waitForRoom(), so either the producer sees the
+    // room or this sees it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (roomWanted.load(std::memory_order_relaxed) &&
+        roomWanted.exchange(false, std::memory_order_relaxed)) {
+      roomMade.release();
+    }
+  }
+
+public:
+  // Holds up to capacity frames. A frame is stale once staleAt frames,
+  // itself included, are queued from it on, never by default.
+  FrameRing(std::size_t depth, std::size_t capacity,
+            std::size_t staleAt = std::numeric_limits<std::size_t>::max())
+      : slots(std::max(depth, capacity)), limit{depth}, staleAt{staleAt} {}
+
+  auto depth() const { return limit; }
+
+  auto queued() const {
+    return pushed.load(std::memory_order_relaxed) -
+           submitted.load(std::memory_order_relaxed);
+  }
+
+  // Producer side. Whether push() would succeed
+  auto hasRoom() const {
+    return pushed.load(std::memory_order_relaxed) -
+               released.load(std::memory_order_acquire) <
+           slots.size();
+  }
+
+  // Producer side. Blocks until hasRoom() or the deadline, false if there is
+  // still no room
+  auto waitForRoom(std::chrono::steady_clock::time_point deadline) -> bool {
+    while (!hasRoom()) {
+      roomWanted.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (hasRoom()) {
+        return true;
+      }
+      if (!roomMade.try_acquire_until(deadline)) {
+        return hasRoom();
+      }
+    }
+    return true;
+  }
+
+  // Producer side. Fails when capacity frames are already held, leaving the
+  // frame to the other sinks or, if there are none, the driver
+  auto push(FrameHandle frame, AudioHandle audio,
+            FrameDescriptor const *descriptor, std::int64_t frameTimecode,
+            std::int64_t audioTimecode,
+            std::chrono::steady_clock::time_point arrivedAt) -> bool {
+    auto const i = pushed.load(std::memory_order_relaxed);
+    if (i - released.load(std::memory_order_acquire) == slots.size()) {
+      return false;
+    }
+    slot(i) = {std::move(frame), std::move(audio), descriptor, frameTimecode,
+               audioTimecode, arrivedAt, std::chrono::steady_clock::now()};
+    pushed.store(i + 1, std::memory_order_release);
+    wake();
+    return true;
+  }
+
+  // Consumer side. The oldest frame not yet given to NDI
+  auto pending() -> Pending {
+    auto const i = submitted.load(std::memory_order_relaxed);
+    auto const end = pushed.load(std::memory_order_acquire);
+    if (i == end) {
+      return {nullptr, nullptr, nullptr, 0, 0, {}, {}, false};
+    }
+    auto const &s = slot(i);
+    return {s.frame.get(), s.audio.get(), s.descriptor, s.frameTimecode,
+            s.audioTimecode, s.arrivedAt, s.pushedAt, end - i >= staleAt};
+  }
+
+  // Consumer side. Call once pending() has been sent, NDI no longer needs
+  // anything older than the last frame sent
+  void submit() {
+    auto const i = submitted.load(std::memory_order_relaxed);
+    auto &s = slot(i);
+    s.audio.reset();
+    if (s.frame != nullptr) {
+      lastVideo = i;
+    }
+    submitted.store(i + 1, std::memory_order_relaxed);
+    releaseUntil(lastVideo);
+  }
+
+  // Consumer side. Call instead of submit() when pending()'s frame was not
+  // sent, it goes back straight away
+  void drop() {
+    auto const i = submitted.load(std::memory_order_relaxed);
+    auto &s = slot(i);
+    s.audio.reset();
+    s.frame.reset();
+    submitted.store(i + 1, std::memory_order_relaxed);
+  }
+
+  // Consumer side. Call once NDI has been flushed, it no longer needs
+  // anything
+  void flush() { releaseUntil(submitted.load(std::memory_order_relaxed)); }
+
+  // Consumer side. Blocks until there may be something new to look at,
+  // pass the value of generation() from before checking pending()
+  auto generation() const { return wakeups.load(std::memory_order_acquire); }
+  void wait(std::uint32_t generation) const { wakeups.wait(generation); }
+
+  void wake() {
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+  }
+};
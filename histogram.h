@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "counters.h"
+
+// Log-linear buckets in the manner of HdrHistogram: each power of two is split
+// into 64 linear steps, so any value is recorded to within 1.6% over the whole
+// 64 bit range. Written by a single thread, read from anywhere.
+class Histogram {
+private:
+  static constexpr auto subBits = 7;
+  static constexpr auto subCount = std::uint64_t{1} << subBits;
+  static constexpr auto halfCount = subCount / 2;
+  static constexpr auto buckets =
+      static_cast<std::size_t>((64 - subBits) * halfCount + subCount);
+
+  std::array<Counter, buckets> counts;
+  Counter total;
+
+  static auto index(std::uint64_t value) -> std::size_t {
+    if (value < subCount) {
+      return static_cast<std::size_t>(value);
+    }
+    auto const shift = std::bit_width(value) - subBits;
+    return static_cast<std::size_t>(shift * halfCount + (value >> shift));
+  }
+
+  // The largest value that lands in the bucket
+  static auto highest(std::size_t i) -> std::uint64_t {
+    if (i < subCount) {
+      return i;
+    }
+    auto const shift = i / halfCount - 1;
+    auto const sub = i - shift * halfCount;
+    return ((sub + 1) << shift) - 1;
+  }
+
+public:
+  void record(std::uint64_t value) {
+    counts[index(value)].add();
+    total.add(value);
+  }
+
+  // The counts at one moment, so a later snapshot less an earlier one covers
+  // just the time in between
+  class Snapshot {
+  private:
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total = 0;
+
+    friend class Histogram;
+
+  public:
+    Snapshot() : counts(buckets) {}
+
+    auto count() const -> std::uint64_t {
+      auto total = std::uint64_t{0};
+      for (auto const c : counts) {
+        total += c;
+      }
+      return total;
+    }
+
+    // Of every value recorded
+    auto sum() const { return total; }
+
+    // How many values are no greater than value, counting whole buckets so
+    // those within the last 1.6% below it may be missed
+    auto atMost(std::uint64_t value) const -> std::uint64_t {
+      auto seen = std::uint64_t{0};
+      for (auto i = std::size_t{0}; i < counts.size() && highest(i) <= value;
+           i++) {
+        seen += counts[i];
+      }
+      return seen;
+    }
+
+    // Smallest recorded value at least q of the values are no greater than,
+    // zero when empty
+    auto percentile(double q) const -> std::uint64_t {
+      auto const total = count();
+      if (total == 0) {
+        return 0;
+      }
+      auto const rank = std::max(
+          std::uint64_t{1},
+          static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(total))));
+      auto seen = std::uint64_t{0};
+      for (auto i = std::size_t{0}; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+          return highest(i);
+        }
+      }
+      return highest(counts.size() - 1);
+    }
+
+    auto max() const { return percentile(1.0); }
+
+    auto operator-(Snapshot const &earlier) const -> Snapshot {
+      auto result = *this;
+      for (auto i = std::size_t{0}; i < counts.size(); i++) {
+        result.counts[i] -= std::min(counts[i], earlier.counts[i]);
+      }
+      result.total -= std::min(total, earlier.total);
+      return result;
+    }
+  };
+
+  auto snapshot() const -> Snapshot {
+    auto result = Snapshot{};
+    for (auto i = std::size_t{0}; i < buckets; i++) {
+      result.counts[i] = counts[i].load();
+    }
+    result.total = total.load();
+    return result;
+  }
+};
@@ -1,86 +1,56 @@
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <condition_variable>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <ztd/out_ptr.hpp>
 
 #include <Processing.NDI.Lib.h>
 
-#if defined(__unix__) || defined(__unix) ||                                    \
-    (defined(__APPLE__) && defined(__MACH__))
-#define UNIX
-#endif
+#include "audio.h"
+#include "backpressure.h"
+#include "bench.h"
+#include "buffer_pool.h"
+#include "clock.h"
+#include "counters.h"
+#include "cpu.h"
+#include "decklink.h"
+#include "deinterlace.h"
+#include "discovery.h"
+#include "events.h"
+#include "fake_decklink.h"
+#include "fields.h"
+#include "frame_descriptor.h"
+#include "frame_ring.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "ndi.h"
+#include "options.h"
+#include "stages.h"
+#include "playout.h"
+#include "proxy.h"
+#include "sink.h"
+#include "trace.h"
+#include "v210.h"
+#include "workers.h"
 
 #if defined(UNIX)
 #include <DeckLinkAPIDispatch.cpp>
 #elif defined(WIN32)
 #include <DeckLinkAPI_i.c>
-#include <DeckLinkAPI_i.h>
-#endif
-
-#if defined(UNIX)
-#include <dlfcn.h>
-#elif defined(WIN32)
-#include <windows.h>
-#endif
-
-#if defined(UNIX)
-constexpr auto True = true;
-constexpr auto False = false;
-#elif defined(WIN32)
-constexpr auto True = TRUE;
-constexpr auto False = FALSE;
 #endif
 
 using namespace std::literals;
 
-constexpr auto bmdColourSpace = bmdFormat8BitYUV;
-constexpr auto ndiColourSpace = NDIlib_FourCC_type_UYVY;
-
-struct DeckLinkRelease {
-  void operator()(IUnknown *p) {
-    if (p != nullptr) {
-      p->Release();
-    }
-  }
-};
-
-template <typename T> using DeckLinkPtr = std::unique_ptr<T, DeckLinkRelease>;
-
-template <typename T> auto MakeDeckLinkPtr(T *p) { return DeckLinkPtr<T>{p}; }
-
-struct DLString {
-#if defined(__linux__)
-  char const * data;
-#elif defined(__APPLE__) && defined(__MACH__)
-  CFStringRef data;
-#elif defined(WIN32)
-  BSTR data;
-#endif
-
-  void print() const {
-#if defined(__linux__)
-    std::cout << data;
-#elif defined(__APPLE__) && defined(__MACH__)
-    std::cout << CFStringGetCStringPtr(data, kCFStringEncodingASCII);
-#elif defined(WIN32)
-    std::wcout << data;
-#endif
-  }
-
-  ~DLString() {
-#if defined(__linux__)
-    free(const_cast<char*>(data));
-#elif defined(__APPLE__) && defined(__MACH__)
-    CFRelease(data);
-#elif defined(WIN32)
-    SysFreeString(data);
-#endif
-  }
-};
-
 using ztd::out_ptr::out_ptr;
 
 template <typename T> auto find_if(auto &&it, auto const &f) {
@@ -93,58 +63,109 @@ template <typename T> auto find_if(auto &&it, auto const &f) {
   return DeckLinkPtr<T>{};
 }
 
-class Callback : public IDeckLinkInputCallback {
+class Callback : public ComObject<IDeckLinkInputCallback> {
 private:
-  DeckLinkPtr<IDeckLinkDisplayMode> displayMode;
+  NdiLibrary const &ndi;
+  std::string name;
 
-  DeckLinkPtr<IDeckLinkVideoInputFrame> lastFrame;
+  IDeckLinkInput *input;
+  DeckLinkAllocator *allocator;
+  BMDVideoInputFlags inputFlags;
 
-#if defined(UNIX)
-  void *
-#elif defined(WIN32)
-  HMODULE
-#endif
-      dl;
+  // Both DeckLink callbacks arrive on the driver's capture thread, which is
+  // the only thread to touch these once streams have started
+  BMDPixelFormat pixelFormat;
+  std::chrono::steady_clock::time_point formatChangedAt;
+  bool formatChanging = false;
+  std::optional<std::chrono::steady_clock::time_point> removedAt;
+  ClockRecovery clock;
+  // Timecode less stream time, to place audio on the same timeline as video
+  std::int64_t streamOffset = 0;
+  // Stream time the next frame should have, any gap is frames the driver
+  // dropped. Negative after the stream restarts.
+  BMDTimeValue expectedStreamTime = -1;
+
+  FrameDescriptors descriptors;
+  BufferPool conversions;
+
+  // Only touched by the sender thread
+  std::optional<Deinterlacer> deinterlacer;
+  // The last frame deinterlaced, kept for the next to compare with
+  FrameDescriptor const *previousDescriptor = nullptr;
+  void const *previousPicture = nullptr;
+  DeckLinkPtr<IDeckLinkVideoInputFrame> previousFrame;
+  PooledBuffer previousConverted;
+
+  int audioChannels;
+  BMDAudioSampleType audioSampleType;
+  BufferPool audioBuffers{false};
+  std::size_t audioBufferSize;
+
+  FrameRing frames;
+  Backpressure backpressure;
+  // Driver queue length to flush at, zero for never
+  std::size_t flushBacklog;
+  StreamCounters counters;
+  StageLatency stages;
 
-  NDIlib_v5 const *lib;
   NDIlib_send_instance_t sender;
+  // Fed the same frames as the sender, each at its own pace
+  std::vector<std::unique_ptr<FrameSink>> sinks;
 
-public:
-  Callback(DeckLinkPtr<IDeckLinkDisplayMode> _displayMode) : displayMode{std::move(_displayMode)} {
-#if defined(__APPLE__) && defined(__MACH__)
-    auto dir = "/usr/local/lib"s;
-#else
-    auto dir = std::string{std::getenv(NDILIB_REDIST_FOLDER)};
-#endif
-    auto path = dir + "/" + NDILIB_LIBRARY_NAME;
+  // Whether anyone is receiving, only looked at when idle is not Send
+  IdleMode idle;
+  std::atomic<bool> watched = true;
+  std::atomic<bool> restarted = false;
+  // Paused for want of receivers, only ever set by the watch thread. Neither
+  // side holds a lock over driver calls, as the driver may wait for a
+  // callback in progress before pausing.
+  std::atomic<bool> paused = false;
 
-#if defined(UNIX)
-    dl = dlopen(path.c_str(), 0);
-#elif defined(WIN32)
-    dl = LoadLibraryA(path.c_str());
-#endif
-    if (!dl) {
-      std::cerr << "Can't find NDI lib, please get it from " << NDILIB_REDIST_URL << '\n';
-      std::terminate();
-    }
-    lib = reinterpret_cast<decltype(&NDIlib_v5_load)>(
-#if defined(UNIX)
-        dlsym
-#elif defined(WIN32)
-        GetProcAddress
-#endif
-        (dl, "NDIlib_v5_load"))();
-    if (lib == nullptr) {
-      std::cerr << "Can't find NDI symbol\n";
-      std::terminate();
+  std::jthread senderThread;
+  std::jthread watchThread;
+
+public:
+  // workers is only needed with --deinterlace
+  Callback(NdiLibrary const &ndi, WorkerPool *workers, IDeckLinkInput *input,
+           DeckLinkAllocator *allocator, BMDVideoInputFlags inputFlags,
+           IDeckLinkDisplayMode *displayMode, BMDPixelFormat pixelFormat,
+           std::string const &name, int core, Options const &options)
+      : ndi{ndi}, name{name}, input{input}, allocator{allocator},
+        inputFlags{inputFlags}, pixelFormat{pixelFormat}, conversions{options.hugePages},
+        audioChannels{options.audioChannels},
+        audioSampleType{static_cast<BMDAudioSampleType>(options.audioDepth)},
+        audioBufferSize{static_cast<std::size_t>(options.audioChannels) *
+                        audioPacketFrames * sizeof(float)},
+        frames{options.depth,
+               Backpressure::Capacity(options.dropPolicy, options.depth),
+               Backpressure::StaleAt(options.dropPolicy, options.depth)},
+        backpressure{name, options.dropPolicy, options.blockTimeout},
+        flushBacklog{options.flushBacklog}, idle{options.idle} {
+    descriptors.select(displayMode, pixelFormat);
+    if (options.deinterlace != DeinterlaceMode::Off && workers != nullptr) {
+      deinterlacer.emplace(options.deinterlace, *workers, options.hugePages);
     }
 
-    auto send_create = NDIlib_send_create_t{"DeckLink", nullptr, false, false};
+    auto send_create =
+        NDIlib_send_create_t{name.c_str(), nullptr, false, false};
 
-    sender = lib->send_create(&send_create);
+    sender = ndi->send_create(&send_create);
     if (sender == nullptr) {
       std::cerr << "Error creating NDI sender\n";
     }
+
+    if (options.proxy.divisor != 0 || options.proxy.width != 0) {
+      if (auto proxy = ProxySink::Open(ndi, name, options)) {
+        sinks.push_back(std::move(proxy));
+      }
+    }
+
+    senderThread = std::jthread{[this, core](std::stop_token stop) {
+      if (core >= 0 && !PinCurrentThread(static_cast<unsigned>(core))) {
+        std::cerr << "Could not pin sender thread to core " << core << '\n';
+      }
+      run(stop);
+    }};
   }
 
   Callback(Callback const &) = delete;
@@ -152,58 +173,449 @@ public:
   Callback(Callback &&) = delete;
   Callback &operator=(Callback &&) = delete;
 
-  ~Callback() {
-    lib->send_destroy(sender);
-#if defined(UNIX)
-    dlclose(dl);
-#elif defined(WIN32)
-    FreeLibrary(dl);
-#endif
+  // Enough for a frame's worth of audio at any rate DeckLink captures, larger
+  // packets grow the buffers
+  static constexpr auto audioPacketFrames = std::size_t{4096};
+
+protected:
+  ~Callback() override {
+    drain();
+    ndi->send_destroy(sender);
+  }
+
+public:
+  // Logs the time to recover on the first frame, call before streams start
+  void recovering(std::chrono::steady_clock::time_point since) {
+    removedAt = since;
+  }
+
+  // Follows the number of NDI receivers, call once streams have started
+  void startWatching() {
+    if (idle != IdleMode::Send) {
+      watchThread =
+          std::jthread{[this](std::stop_token stop) { watch(stop); }};
+    }
   }
 
+  // Call before stopping streams, so they are not restarted behind our back
+  void stopWatching() {
+    if (watchThread.joinable()) {
+      watchThread.request_stop();
+      watchThread.join();
+    }
+  }
+
+  // Sends whatever has already been captured and waits for NDI to finish
+  // with it, call once the input has been stopped
+  void drain() {
+    stopWatching();
+    if (senderThread.joinable()) {
+      senderThread.request_stop();
+      senderThread.join();
+    }
+    for (auto const &sink : sinks) {
+      sink->drain();
+    }
+  }
+
+  auto stats() const -> StreamStats {
+    return {counters.captured.load(), counters.missed.load(),
+            counters.sent.load(),
+            counters.audioSent.load(), counters.audioMissing.load(),
+            counters.unwatched.load(),
+            counters.drops.load(),
+            counters.flushed.load(),
+            frames.queued(),
+            counters.queueLatencyTotal.load(),
+            counters.queueLatencyMax.load(),
+            counters.formatChanges.load(),
+            counters.formatChangeFramesLost.load(),
+            counters.captureCpu.load() + counters.senderCpu.load(),
+            clock.driftPpm()};
+  }
+
+  auto latency() const { return stages.snapshot(); }
+
+  // For metrics, none of these wait on the capture path
+  auto connections() const {
+    return ndi->send_get_no_connections(sender, 0);
+  }
+
+  auto tally() const {
+    auto tally = NDIlib_tally_t{};
+    ndi->send_get_tally(sender, &tally, 0);
+    return tally;
+  }
+
+  auto conversionStats() const { return conversions.stats(); }
+
+  template <typename F> void forEachSink(F &&f) const {
+    for (auto const &sink : sinks) {
+      f(*sink);
+    }
+  }
+  auto audioBufferStats() const { return audioBuffers.stats(); }
+
 private:
   auto VideoInputFrameArrived(IDeckLinkVideoInputFrame *videoFrame,
                               IDeckLinkAudioInputPacket *audioPacket)
       -> HRESULT override {
-    videoFrame->AddRef();
-    auto bmd_frame = MakeDeckLinkPtr(videoFrame);
+    if (videoFrame == nullptr && audioPacket == nullptr) {
+      return S_OK;
+    }
+    auto const arrivedAt = std::chrono::steady_clock::now();
+    auto const cpuStart = ThreadCpuTime();
+    trace::NameThread(name, "capture");
+    auto scope = trace::Scope{"arrived"};
 
+    auto frameTimecode = std::int64_t{0};
+    if (videoFrame != nullptr) {
+      counters.captured.add();
+      if (formatChanging) {
+        formatChanging = false;
+        formatChanged();
+      }
+      if (removedAt) {
+        std::cout << name << ": recovered, first frame "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - *removedAt)
+                         .count()
+                  << "ms after removal\n";
+        removedAt.reset();
+      }
+      frameTimecode = timecode(videoFrame);
+      scope.setFrame(frameTimecode);
+      if (audioPacket == nullptr && audioChannels > 0) {
+        counters.audioMissing.add();
+      }
+    }
+    auto audioTimecode = std::int64_t{0};
+    if (audioPacket != nullptr) {
+      auto packetTime = BMDTimeValue{};
+      audioTimecode =
+          streamOffset != 0 && audioPacket->GetPacketTime(
+                                   &packetTime, ndiTicksPerSecond) == S_OK
+              ? packetTime + streamOffset
+              : NDIlib_send_timecode_synthesize;
+    }
+
+    // Every sink takes a reference of its own, the driver gets the frame back
+    // once they have all let go. The sender goes last, as it may block.
+    auto const frame = FrameHandle{videoFrame};
+    auto const descriptor = descriptors.get();
+    if (videoFrame != nullptr) {
+      for (auto const &sink : sinks) {
+        sink->offer(frame, descriptor, frameTimecode, arrivedAt);
+      }
+    }
+    if (backpressure.push(frames, counters.drops, frame,
+                          AudioHandle{audioPacket}, descriptor, frameTimecode,
+                          audioTimecode, arrivedAt)) {
+      stages.record(Stage::Callback,
+                    std::chrono::steady_clock::now() - arrivedAt);
+    }
+    if (videoFrame != nullptr && flushBacklog > 0) {
+      flushIfBehind();
+    }
+    counters.captureCpu.add(
+        static_cast<std::uint64_t>((ThreadCpuTime() - cpuStart).count()));
+    return S_OK;
+  }
+
+  // Clears the driver's queue once it holds more than flushBacklog frames,
+  // which only happens while a sink blocks the capture thread
+  void flushIfBehind() {
+    auto available = uint32_t{0};
+    if (input->GetAvailableVideoFrameCount(&available) != S_OK ||
+        available <= flushBacklog) {
+      return;
+    }
+    input->FlushStreams();
+    counters.flushed.add(available);
+    // The gap in stream time is counted here rather than as missed
+    expectedStreamTime = -1;
+    std::cout << name << ": " << available
+              << " frames queued in the driver, flushed\n";
+  }
+
+  // Places the frame on the system clock by way of the card's reference
+  // clock, so sources on different cards and machines line up
+  auto timecode(IDeckLinkVideoInputFrame *videoFrame) -> std::int64_t {
+    auto const now = NdiNow();
+    auto hardwareTime = BMDTimeValue{};
+    auto duration = BMDTimeValue{};
+    auto const result =
+        videoFrame->GetHardwareReferenceTimestamp(ndiTicksPerSecond,
+                                                  &hardwareTime, &duration) ==
+                S_OK
+            ? clock.map(hardwareTime, now)
+            : now;
+    stages.record(Stage::Delivery, std::chrono::nanoseconds{
+                                       (now - result) * 1'000'000'000 /
+                                       ndiTicksPerSecond});
+
+    auto streamTime = BMDTimeValue{};
+    if (videoFrame->GetStreamTime(&streamTime, &duration, ndiTicksPerSecond) ==
+        S_OK) {
+      streamOffset = result - streamTime;
+      if (restarted.exchange(false, std::memory_order_relaxed)) {
+        expectedStreamTime = -1;
+      }
+      if (expectedStreamTime >= 0 && duration > 0 &&
+          streamTime > expectedStreamTime) {
+        counters.missed.add(static_cast<std::uint64_t>(
+            (streamTime - expectedStreamTime + duration / 2) / duration));
+      }
+      expectedStreamTime = streamTime + duration;
+    }
+    return result;
+  }
+
+  void run(std::stop_token stop) {
+    trace::NameThread(name, "sender");
+    auto const wakeOnStop = std::stop_callback{stop, [&] { frames.wake(); }};
+    auto held = PooledBuffer{};
+    // When the frame NDI has was sent, it is handed back at the next send.
+    // Nothing is held while this is the epoch.
+    auto heldSince = std::chrono::steady_clock::time_point{};
+    auto handedBack = [&] {
+      auto const now = std::chrono::steady_clock::now();
+      if (heldSince != std::chrono::steady_clock::time_point{}) {
+        stages.record(Stage::Held, now - heldSince);
+        trace::Span("held", heldSince, now);
+      }
+      return now;
+    };
+    auto sending = true;
+    while (true) {
+      auto const generation = frames.generation();
+      while (auto const pending = frames.pending()) {
+        if (!watched.load(std::memory_order_acquire)) {
+          // Nobody to send to, so let NDI go of the last frame and hand
+          // everything straight back to the driver
+          if (sending) {
+            sending = false;
+            ndi->send_send_video_async_v2(sender, nullptr);
+            handedBack();
+            heldSince = {};
+            held.reset();
+            forgetPrevious();
+          }
+          if (pending.frame != nullptr) {
+            counters.unwatched.add();
+          }
+          frames.submit();
+          frames.flush();
+          continue;
+        }
+        sending = true;
+        auto const poppedAt = std::chrono::steady_clock::now();
+        if (pending.audio != nullptr) {
+          auto const scope = trace::Scope{"audio"};
+          sendAudio(pending.audio, pending.audioTimecode);
+          counters.audioSent.add();
+        }
+        if (pending.frame != nullptr && pending.stale) {
+          // Newer frames have been queued behind it under drop oldest, so
+          // only its audio goes
+          counters.drops.stale.add();
+          frames.drop();
+          continue;
+        }
+        if (pending.frame != nullptr) {
+          auto const latency =
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  poppedAt - pending.pushedAt);
+          counters.queueLatencyTotal.add(latency.count());
+          counters.queueLatencyMax.max(latency.count());
+          stages.record(Stage::Queue, latency);
+          trace::Span("queue", pending.pushedAt, poppedAt,
+                      pending.frameTimecode);
+          auto sent = send(pending.frame, *pending.descriptor,
+                           pending.frameTimecode);
+          if (!sent) {
+            // NDI still has the last frame sent, which must stay held
+            counters.drops.noMemory.add();
+            frames.drop();
+            continue;
+          }
+          held = std::move(*sent);
+          counters.sent.add();
+          auto const submittedAt = handedBack();
+          heldSince = submittedAt;
+          stages.record(Stage::Total, submittedAt - pending.arrivedAt);
+          counters.senderCpu.max(
+              static_cast<std::uint64_t>(ThreadCpuTime().count()));
+        }
+        frames.submit();
+      }
+      if (stop.stop_requested()) {
+        break;
+      }
+      frames.wait(generation);
+    }
+    ndi->send_send_video_async_v2(sender, nullptr);
+    handedBack();
+    forgetPrevious();
+    frames.flush();
+  }
+
+  // Hands the frame kept for deinterlacing back
+  void forgetPrevious() {
+    previousDescriptor = nullptr;
+    previousPicture = nullptr;
+    previousFrame.reset();
+    previousConverted.reset();
+  }
+
+  // Returns the converted or deinterlaced copy of the frame, if one was
+  // needed, which NDI will read until the next send. Nothing if there was no
+  // memory for it and the frame was not sent, the reason having been logged.
+  auto send(IDeckLinkVideoInputFrame *bmd_frame,
+            FrameDescriptor const &descriptor, std::int64_t timecode)
+      -> std::optional<PooledBuffer> {
     void *data;
     bmd_frame->GetBytes(&data);
 
-    BMDTimeValue fps_value;
-    BMDTimeScale fps_scale;
-    displayMode->GetFrameRate(&fps_value, &fps_scale);
-
-    auto format = [&] {
-      switch (displayMode->GetFieldDominance()) {
-        case bmdUnknownFieldDominance:
-          std::cerr << "Unknown field dominance\n";
-          std::terminate();
-        case bmdLowerFieldFirst:
-          std::cerr << "NDI does not support bottom field first formats\n";
-          std::terminate();
-        case bmdUpperFieldFirst:
-          return NDIlib_frame_format_type_interleaved;
-        case bmdProgressiveFrame:
-          return NDIlib_frame_format_type_progressive;
-        case bmdProgressiveSegmentedFrame:
-          return NDIlib_frame_format_type_interleaved;
-        default:
-          std::cerr << "Unknown enum case\n";
-          std::terminate();
+    auto const start = std::chrono::steady_clock::now();
+    auto ndi_frame = MakeNdiFrame(descriptor, data, timecode);
+
+    auto converted = PooledBuffer{};
+    if (descriptor.pixelFormat == bmdFormat10BitYUV) {
+      auto scope = trace::Scope{"convert"};
+      scope.setFrame(timecode);
+      converted = Acquire(conversions, descriptor.convertedSize);
+      if (converted == nullptr) {
+        std::cerr << "Could not allocate a P216 frame\n";
+        return std::nullopt;
       }
+      auto const p216 = static_cast<uint16_t *>(converted.get());
+      v210::ToP216(static_cast<uint8_t const *>(data), descriptor.rowBytes,
+                   p216, descriptor.width, descriptor.height, v210::BestRow,
+                   descriptor.lowerFieldFirst);
+      ndi_frame.p_data = reinterpret_cast<uint8_t *>(p216);
+    } else if (descriptor.lowerFieldFirst) {
+      auto scope = trace::Scope{"convert"};
+      scope.setFrame(timecode);
+      converted = Acquire(conversions, descriptor.convertedSize);
+      if (converted == nullptr) {
+        std::cerr << "Could not allocate a frame to reorder fields into\n";
+        return std::nullopt;
+      }
+      fields::ShiftDown(static_cast<uint8_t const *>(data),
+                        static_cast<uint8_t *>(converted.get()),
+                        descriptor.rowBytes, descriptor.height);
+      ndi_frame.p_data = static_cast<uint8_t *>(converted.get());
+    }
+    auto const convertedAt = std::chrono::steady_clock::now();
+    stages.record(Stage::Convert, convertedAt - start);
+
+    if (deinterlacer && descriptor.interlaced) {
+      return sendDeinterlaced(bmd_frame, descriptor, ndi_frame,
+                              std::move(converted), convertedAt);
+    }
+    if (deinterlacer) {
+      // Progressive segmented frames are whole pictures already
+      ndi_frame.frame_format_type = NDIlib_frame_format_type_progressive;
+    }
+
+    {
+      auto scope = trace::Scope{"submit"};
+      scope.setFrame(timecode);
+      ndi->send_send_video_async_v2(sender, &ndi_frame);
+    }
+    stages.record(Stage::Submit,
+                  std::chrono::steady_clock::now() - convertedAt);
+    return converted;
+  }
+
+  // Sends a picture for each field, the second of which is returned for NDI
+  // to read until the next send, or nothing as for send(). ndi_frame is the
+  // frame as send() would have sent it, converted the copy it points into, if
+  // any.
+  auto sendDeinterlaced(IDeckLinkVideoInputFrame *bmd_frame,
+                        FrameDescriptor const &descriptor,
+                        NDIlib_video_frame_v2_t ndi_frame,
+                        PooledBuffer converted,
+                        std::chrono::steady_clock::time_point start)
+      -> std::optional<PooledBuffer> {
+    auto pictures = [&] {
+      auto scope = trace::Scope{"deinterlace"};
+      scope.setFrame(ndi_frame.timecode);
+      return deinterlacer->run(
+          descriptor, ndi_frame.p_data,
+          previousDescriptor == &descriptor ? previousPicture : nullptr);
     }();
+    auto const deinterlacedAt = std::chrono::steady_clock::now();
+    stages.record(Stage::Deinterlace, deinterlacedAt - start);
 
-    auto ndi_frame = NDIlib_video_frame_v2_t(
-        bmd_frame->GetWidth(), bmd_frame->GetHeight(), ndiColourSpace, fps_scale, fps_value,
-        0.0f, format, 0,
-        static_cast<uint8_t *>(data), bmd_frame->GetRowBytes());
+    previousDescriptor = &descriptor;
+    previousPicture = ndi_frame.p_data;
+    if (converted != nullptr) {
+      previousConverted = std::move(converted);
+      previousFrame.reset();
+    } else {
+      bmd_frame->AddRef();
+      previousFrame = MakeDeckLinkPtr(bmd_frame);
+      previousConverted.reset();
+    }
 
-    lib->send_send_video_async_v2(sender, &ndi_frame);
+    if (pictures[0] == nullptr) {
+      std::cerr << "Could not allocate deinterlaced frames\n";
+      return std::nullopt;
+    }
 
-    lastFrame = std::move(bmd_frame);
-    return S_OK;
+    ndi_frame.frame_format_type = NDIlib_frame_format_type_progressive;
+    ndi_frame.frame_rate_N *= 2;
+    {
+      auto scope = trace::Scope{"submit"};
+      scope.setFrame(ndi_frame.timecode);
+      ndi_frame.p_data = static_cast<uint8_t *>(pictures[0].get());
+      ndi->send_send_video_async_v2(sender, &ndi_frame);
+      if (ndi_frame.timecode != NDIlib_send_timecode_synthesize) {
+        ndi_frame.timecode += ndiTicksPerSecond * descriptor.frameRateD /
+                              descriptor.frameRateN / 2;
+      }
+      // Sending the second hands the first back
+      ndi_frame.p_data = static_cast<uint8_t *>(pictures[1].get());
+      ndi->send_send_video_async_v2(sender, &ndi_frame);
+    }
+    stages.record(Stage::Submit,
+                  std::chrono::steady_clock::now() - deinterlacedAt);
+    return std::move(pictures[1]);
+  }
+
+  // NDI copies audio before returning, so the planar buffer goes straight back
+  // to the pool
+  void sendAudio(IDeckLinkAudioInputPacket *packet, std::int64_t timecode) {
+    auto const sampleFrames = packet->GetSampleFrameCount();
+    void *data;
+    packet->GetBytes(&data);
+
+    audioBufferSize = std::max(audioBufferSize,
+                               static_cast<std::size_t>(sampleFrames) *
+                                   audioChannels * sizeof(float));
+    auto const planar = Acquire(audioBuffers, audioBufferSize);
+    if (planar == nullptr) {
+      std::cerr << "Could not allocate an audio buffer\n";
+      return;
+    }
+    auto const samples = static_cast<float *>(planar.get());
+    if (audioSampleType == bmdAudioSampleType16bitInteger) {
+      audio::BestDeinterleave<std::int16_t>(
+          static_cast<std::int16_t const *>(data), samples, sampleFrames,
+          audioChannels, sampleFrames);
+    } else {
+      audio::BestDeinterleave<std::int32_t>(
+          static_cast<std::int32_t const *>(data), samples, sampleFrames,
+          audioChannels, sampleFrames);
+    }
+
+    auto ndi_frame = NDIlib_audio_frame_v2_t(
+        bmdAudioSampleRate48kHz, audioChannels, static_cast<int>(sampleFrames),
+        timecode, samples,
+        static_cast<int>(sampleFrames * sizeof(float)));
+    ndi->send_send_audio_v2(sender, &ndi_frame);
   }
 
   auto
@@ -211,141 +623,439 @@ private:
                           IDeckLinkDisplayMode *newDisplayMode,
                           BMDDetectedVideoInputFormatFlags detectedSignalFlags)
       -> HRESULT override {
-    displayMode = MakeDeckLinkPtr(newDisplayMode);
+    formatChangedAt = std::chrono::steady_clock::now();
+    if (notificationEvents & bmdVideoInputColorspaceChanged) {
+      pixelFormat = DetectedPixelFormat(detectedSignalFlags);
+    }
+
+    input->PauseStreams();
+    allocator->expect(static_cast<std::size_t>(
+        RowBytes(pixelFormat, newDisplayMode->GetWidth()) *
+        newDisplayMode->GetHeight()));
+    if (input->EnableVideoInput(newDisplayMode->GetDisplayMode(), pixelFormat,
+                                inputFlags) != S_OK) {
+      std::cerr << "Could not switch to the new input format\n";
+      resume();
+      return S_OK;
+    }
+    descriptors.select(newDisplayMode, pixelFormat);
+    expectedStreamTime = -1;
+    input->FlushStreams();
+    resume();
+
+    formatChanging = true;
+    counters.formatChanges.add();
     return S_OK;
   }
 
+  // Starts the streams after re-arming, unless the watch thread has paused
+  // them, including while they were being started
+  void resume() {
+    if (!paused.load(std::memory_order_acquire)) {
+      input->StartStreams();
+      if (paused.load(std::memory_order_acquire)) {
+        input->PauseStreams();
+      }
+    }
+  }
+
+  // Waiting on NDI with a timeout returns as soon as a receiver connects, so
+  // sending resumes within a frame. Losing the last receiver only needs
+  // noticing eventually.
+  void watch(std::stop_token stop) {
+    auto mutex = std::mutex{};
+    auto sleeper = std::condition_variable_any{};
+    // Someone receiving from a sink alone still needs frames
+    auto const sinkReceivers = [&] {
+      auto receivers = 0;
+      for (auto const &sink : sinks) {
+        receivers += sink->receivers();
+      }
+      return receivers;
+    };
+    while (!stop.stop_requested()) {
+      if (watched.load(std::memory_order_relaxed)) {
+        if (ndi->send_get_no_connections(sender, 0) == 0 &&
+            sinkReceivers() == 0) {
+          setWatched(false);
+        } else {
+          auto lock = std::unique_lock{mutex};
+          sleeper.wait_for(lock, stop, 250ms, [] { return false; });
+        }
+      } else if (sinkReceivers() > 0 ||
+                 ndi->send_get_no_connections(sender, 100) > 0) {
+        setWatched(true);
+      }
+    }
+  }
+
+  void setWatched(bool value) {
+    if (idle == IdleMode::Pause) {
+      paused.store(!value, std::memory_order_release);
+      if (value) {
+        restarted.store(true, std::memory_order_relaxed);
+        input->StartStreams();
+      } else {
+        input->PauseStreams();
+      }
+    }
+    watched.store(value, std::memory_order_release);
+    std::cout << name
+              << (value ? ": receiver connected, sending\n"
+                        : ": no receivers, idle\n");
+  }
+
+  // Called on the first frame in a new format
+  void formatChanged() {
+    auto const descriptor = descriptors.get();
+    auto const elapsed = std::chrono::duration<double>{
+        std::chrono::steady_clock::now() - formatChangedAt};
+    auto const frameDuration = static_cast<double>(descriptor->frameRateD) /
+                               descriptor->frameRateN;
+    auto const lost = std::max(
+        0l, std::lround(elapsed.count() / frameDuration) - 1);
+    counters.formatChangeFramesLost.add(static_cast<std::uint64_t>(lost));
+
+    std::cout << "Input switched to " << descriptor->width << 'x'
+              << descriptor->height << ' '
+              << PixelFormatName(descriptor->pixelFormat) << " at "
+              << 1 / frameDuration << "fps, first frame after "
+              << std::lround(elapsed.count() * 1000) << "ms (" << lost
+              << " frames lost)\n";
+  }
+
   auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    if (IsIUnknown(iid) || SameIID(iid, IID_IDeckLinkInputCallback)) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkInputCallback *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
     return E_NOINTERFACE;
   }
-  auto AddRef() -> ULONG override { return 0; }
-  auto Release() -> ULONG override { return 0; }
 };
 
-int main(int, char **) {
-  auto deckLink = [&] {
-#if defined(UNIX)
-    auto deckLinkIterator = MakeDeckLinkPtr(CreateDeckLinkIteratorInstance());
-#elif defined(WIN32)
-    if (CoInitialize(nullptr) != S_OK) {
-      std::cerr << "Could not initialise COM (Windows)\n";
-      std::terminate();
+// One input captured to its own NDI sender
+class Capture {
+private:
+  std::string name;
+  DeckLinkPtr<IDeckLinkInput> input;
+  DeckLinkPtr<DeckLinkAllocator> allocator;
+  DeckLinkPtr<Callback> callback;
+  bool videoEnabled = false;
+  bool audioEnabled = false;
+  bool callbackSet = false;
+  bool running = false;
+  StageLatency::Snapshot lastLatency;
+  std::chrono::steady_clock::time_point lastLatencyAt =
+      std::chrono::steady_clock::now();
+
+  explicit Capture(std::string name) : name{std::move(name)} {}
+
+  auto start(NdiLibrary const &ndi, WorkerPool *workers, IDeckLink *deckLink,
+             IDeckLinkDisplayMode *displayMode, int core,
+             Options const &options,
+             std::optional<std::chrono::steady_clock::time_point> removedAt)
+      -> bool {
+    if (deckLink->QueryInterface(IID_IDeckLinkInput, out_ptr(input)) !=
+        S_OK) {
+      std::cerr << name << ": could not get a DeckLink input\n";
+      return false;
     }
-    auto deckLinkIterator = DeckLinkPtr<IDeckLinkIterator>{};
-    if (CoCreateInstance(CLSID_CDeckLinkIterator, nullptr, CLSCTX_ALL,
-                         IID_IDeckLinkIterator,
-                         out_ptr(deckLinkIterator)) != S_OK) {
-      std::cerr << "Could not get a DeckLink Iterator (Windows)\n";
-      std::terminate();
+
+    auto const pixelFormat =
+        options.tenBit ? bmdFormat10BitYUV : bmdFormat8BitYUV;
+
+    allocator = DeckLinkPtr<DeckLinkAllocator>{new DeckLinkAllocator{
+        options.hugePages,
+        static_cast<std::size_t>(
+            RowBytes(pixelFormat, displayMode->GetWidth()) *
+            displayMode->GetHeight()),
+        options.poolFrames}};
+    if (input->SetVideoInputFrameMemoryAllocator(allocator.get()) != S_OK) {
+      std::cerr << name << ": could not set frame allocator\n";
+      return false;
     }
-#endif
 
-    if (deckLinkIterator == nullptr) {
-      std::cerr << "Could not get a DeckLink Iterator\n";
-      std::terminate();
+    auto const inputFlags = [&] {
+      auto attributes = DeckLinkPtr<IDeckLinkProfileAttributes>{};
+      auto formatDetection = False;
+      // out_ptr only stores its result at the end of the full expression
+      if (deckLink->QueryInterface(IID_IDeckLinkProfileAttributes,
+                                   out_ptr(attributes)) == S_OK) {
+        if (attributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection,
+                                &formatDetection) == S_OK &&
+            formatDetection) {
+          return bmdVideoInputEnableFormatDetection;
+        }
+      }
+      std::cout << name << ": input format detection is not supported\n";
+      return bmdVideoInputFlagDefault;
+    }();
+
+    if (input->EnableVideoInput(displayMode->GetDisplayMode(), pixelFormat,
+                                inputFlags) != S_OK) {
+      std::cerr << name << ": could not enable video input\n";
+      return false;
     }
+    videoEnabled = true;
 
-    auto deckLinks = std::vector<DeckLinkPtr<IDeckLink>>{};
-    {
-      auto deckLink = DeckLinkPtr<IDeckLink>{};
-      while (deckLinkIterator->Next(out_ptr(deckLink)) == S_OK) {
-        deckLinks.push_back(std::move(deckLink));
+    if (options.audioChannels > 0) {
+      if (input->EnableAudioInput(
+              bmdAudioSampleRate48kHz,
+              static_cast<BMDAudioSampleType>(options.audioDepth),
+              static_cast<uint32_t>(options.audioChannels)) != S_OK) {
+        std::cerr << name << ": could not enable audio input\n";
+        return false;
       }
+      audioEnabled = true;
     }
-  
-    auto deckLinkIndex = [&] {
-      if (deckLinks.empty()) {
-        std::cerr << "Could not find a DeckLink device\n";
-        std::terminate();
-      } else {
-        std::cout << "DeckLinks:\n";
-        {
-          auto i = 0;
-          for (auto const & deckLink : deckLinks) {
-            auto name = DLString{};
-            deckLink->GetDisplayName(&name.data);
-            std::cout << i++ << ' ';
-            name.print();
-            std::cout << '\n';
-          }
-        }
-        std::cout << "Please select: ";
-        auto i = -1;
-        while (i < 0 || i >= deckLinks.size()) {
-          std::cin >> i;
-        }
-        return i;
+
+    callback = DeckLinkPtr<Callback>{
+        new Callback{ndi, workers, input.get(), allocator.get(), inputFlags,
+                     displayMode, pixelFormat, name, core, options}};
+    if (removedAt) {
+      callback->recovering(*removedAt);
+    }
+
+    if (input->SetCallback(callback.get()) != S_OK) {
+      std::cerr << name << ": could not set callback\n";
+      return false;
+    }
+    callbackSet = true;
+
+    if (input->StartStreams() != S_OK) {
+      std::cerr << name << ": could not start streams\n";
+      return false;
+    }
+    running = true;
+    callback->startWatching();
+    return true;
+  }
+
+public:
+  // Null if the input could not be started, the reason having been logged.
+  // workers is only needed with --deinterlace.
+  static auto
+  Open(NdiLibrary const &ndi, WorkerPool *workers, IDeckLink *deckLink,
+       IDeckLinkDisplayMode *displayMode, std::string name, int core,
+       Options const &options,
+       std::optional<std::chrono::steady_clock::time_point> removedAt = {})
+      -> std::unique_ptr<Capture> {
+    auto capture = std::unique_ptr<Capture>{new Capture{std::move(name)}};
+    if (!capture->start(ndi, workers, deckLink, displayMode, core, options,
+                        removedAt)) {
+      return nullptr;
+    }
+    return capture;
+  }
+
+  Capture(Capture const &) = delete;
+  Capture &operator=(Capture const &) = delete;
+  Capture(Capture &&) = delete;
+  Capture &operator=(Capture &&) = delete;
+
+  ~Capture() { stop(); }
+
+  // Undoes as much of start() as succeeded
+  void stop() {
+    if (callback != nullptr) {
+      callback->stopWatching();
+    }
+    if (running) {
+      running = false;
+      if (input->StopStreams() != S_OK) {
+        std::cerr << name << ": could not stop streams\n";
       }
-    }();
-  
-    return std::move(deckLinks[deckLinkIndex]);
-  }();
+    }
+    if (callback != nullptr) {
+      callback->drain();
+    }
+    if (callbackSet) {
+      callbackSet = false;
+      input->SetCallback(nullptr);
+    }
+    if (videoEnabled) {
+      videoEnabled = false;
+      input->DisableVideoInput();
+    }
+    if (audioEnabled) {
+      audioEnabled = false;
+      input->DisableAudioInput();
+    }
+  }
+
+  auto stats() const { return callback->stats(); }
+  auto latency() const { return callback->latency(); }
+
+  auto metrics() const -> StreamMetrics {
+    auto const tally = callback->tally();
+    auto sinks = std::vector<std::pair<std::string, SinkStats>>{};
+    callback->forEachSink([&](FrameSink const &sink) {
+      sinks.emplace_back(sink.name(), sink.stats());
+    });
+    return {name,
+            true,
+            callback->stats(),
+            callback->latency(),
+            callback->connections(),
+            tally.on_program,
+            tally.on_preview,
+            allocator->stats(),
+            callback->conversionStats(),
+            callback->audioBufferStats(),
+            std::move(sinks)};
+  }
+
+  void printStats() const {
+    std::cout << name << ": " << callback->stats() << '\n';
+    std::cout << name << " capture buffers: " << allocator->stats() << '\n';
+    callback->forEachSink([](FrameSink const &sink) {
+      std::cout << sink.name() << ": " << sink.stats() << '\n';
+    });
+  }
 
-  {
-    auto name = DLString{};
-    deckLink->GetDisplayName(&name.data);
-    std::cout << "Selected: ";
-    name.print();
-    std::cout << '\n';
+  // Where frames' time went since the last call, or since starting
+  void printLatency() {
+    auto const now = std::chrono::steady_clock::now();
+    auto const latency = callback->latency();
+    std::cout << name << " latency over the last "
+              << std::lround(
+                     std::chrono::duration<double>{now - lastLatencyAt}.count())
+              << "s, p50/p99/max us: " << (latency - lastLatency) << '\n';
+    lastLatency = latency;
+    lastLatencyAt = now;
+  }
+};
+
+auto DeckLinks(Options const &options) -> std::vector<DeckLinkPtr<IDeckLink>> {
+#if defined(UNIX)
+  auto deckLinkIterator =
+      options.fakeDevices > 0
+          ? DeckLinkPtr<IDeckLinkIterator>{new fake::Iterator{options}}
+          : MakeDeckLinkPtr(CreateDeckLinkIteratorInstance());
+#elif defined(WIN32)
+  if (CoInitialize(nullptr) != S_OK) {
+    std::cerr << "Could not initialise COM (Windows)\n";
+    std::terminate();
+  }
+  auto deckLinkIterator = DeckLinkPtr<IDeckLinkIterator>{};
+  if (CoCreateInstance(CLSID_CDeckLinkIterator, nullptr, CLSCTX_ALL,
+                       IID_IDeckLinkIterator,
+                       out_ptr(deckLinkIterator)) != S_OK) {
+    std::cerr << "Could not get a DeckLink Iterator (Windows)\n";
+    std::terminate();
+  }
+#endif
+
+  if (deckLinkIterator == nullptr) {
+    std::cerr << "Could not get a DeckLink Iterator\n";
+    std::terminate();
+  }
+
+  auto deckLinks = std::vector<DeckLinkPtr<IDeckLink>>{};
+  auto deckLink = DeckLinkPtr<IDeckLink>{};
+  while (deckLinkIterator->Next(out_ptr(deckLink)) == S_OK) {
+    deckLinks.push_back(std::move(deckLink));
+  }
+  if (deckLinks.empty()) {
+    std::cerr << "Could not find a DeckLink device\n";
+    std::terminate();
   }
+  return deckLinks;
+}
 
+auto DisplayModes(IDeckLink *deckLink)
+    -> std::vector<DeckLinkPtr<IDeckLinkDisplayMode>> {
   auto deckLinkInput = DeckLinkPtr<IDeckLinkInput>{};
+  auto displayModeIterator = DeckLinkPtr<IDeckLinkDisplayModeIterator>{};
+  // out_ptr only stores its result at the end of the full expression
   if (deckLink->QueryInterface(IID_IDeckLinkInput, out_ptr(deckLinkInput)) !=
       S_OK) {
-    std::cerr << "Could not get a DeckLink input\n";
+    return {};
+  }
+  if (deckLinkInput->GetDisplayModeIterator(out_ptr(displayModeIterator)) !=
+      S_OK) {
+    return {};
+  }
+
+  auto modes = std::vector<DeckLinkPtr<IDeckLinkDisplayMode>>{};
+  auto mode = DeckLinkPtr<IDeckLinkDisplayMode>{};
+  while (displayModeIterator->Next(out_ptr(mode)) == S_OK) {
+    modes.push_back(std::move(mode));
+  }
+  return modes;
+}
+
+auto Name(IDeckLink *deckLink) {
+  auto name = DLString{};
+  deckLink->GetDisplayName(&name.data);
+  return name.str();
+}
+
+auto Name(IDeckLinkDisplayMode *mode) {
+  auto name = DLString{};
+  mode->GetName(&name.data);
+  return name.str();
+}
+
+template <typename T>
+void PrintList(std::vector<DeckLinkPtr<T>> const &list,
+               std::string const &indent = "") {
+  auto i = 0;
+  for (auto const &item : list) {
+    std::cout << indent << i++ << ' ' << Name(item.get()) << '\n';
+  }
+}
+
+template <typename T>
+auto Select(char const *title, std::vector<DeckLinkPtr<T>> const &list) {
+  if (list.empty()) {
+    std::cerr << "Nothing to choose from\n";
     std::terminate();
   }
+  std::cout << title << ":\n";
+  PrintList(list);
+  std::cout << "Please select: ";
+  auto i = -1;
+  while (i < 0 || static_cast<std::size_t>(i) >= list.size()) {
+    std::cin >> i;
+  }
+  std::cout << "Selected: " << Name(list[i].get()) << '\n';
+  return static_cast<std::size_t>(i);
+}
 
-  auto displayMode = [&] {
-    auto displayModeIterator = DeckLinkPtr<IDeckLinkDisplayModeIterator>{};
-    if (deckLinkInput->GetDisplayModeIterator(out_ptr(displayModeIterator)) !=
-        S_OK) {
-      std::cerr << "Could not get a display mode iterator\n";
-      std::terminate();
-    }
+int main(int argc, char **argv) {
+  auto options = ParseOptions(argc, argv);
 
-    auto modes = std::vector<DeckLinkPtr<IDeckLinkDisplayMode>>{};
-    {
-      auto mode = DeckLinkPtr<IDeckLinkDisplayMode>{};
-      while (displayModeIterator->Next(out_ptr(mode)) == S_OK) {
-        modes.push_back(std::move(mode));
-      }
+  // With --bench-json -, stdout carries the JSON alone and everything else
+  // printed goes to stderr
+  auto stdoutJson = std::ostream{std::cout.rdbuf()};
+  if (options.benchJson == "-") {
+    std::cout.rdbuf(std::cerr.rdbuf());
+  }
+
+  auto const deckLinks = DeckLinks(options);
+
+  if (options.list) {
+    auto i = 0;
+    for (auto const &deckLink : deckLinks) {
+      std::cout << i++ << ' ' << Name(deckLink.get()) << '\n';
+      PrintList(DisplayModes(deckLink.get()), "    ");
     }
-  
-    auto const index = [&] {
-      if (modes.empty()) {
-        std::cerr << "Could not find any display modes\n";
-        std::terminate();
-      } else {
-        std::cout << "Modes:\n";
-        {
-          auto i = 0;
-          for (auto const & mode : modes) {
-            auto name = DLString{};
-            mode->GetName(&name.data);
-            std::cout << i++ << ' ';
-            name.print();
-            std::cout << '\n';
-          }
-        }
-        std::cout << "Please select: ";
-        auto i = -1;
-        while (i < 0 || i >= modes.size()) {
-          std::cin >> i;
-        }
-        return i;
-      }
-    }();
-  
-    return std::move(modes[index]);
-  }();
+    return 0;
+  }
 
-  {
-    auto name = DLString{};
-    displayMode->GetName(&name.data);
-    std::cout << "Selected: ";
-    name.print();
-    std::cout << '\n';
+  if (options.bench.count() > 0 && options.inputs.empty()) {
+    std::cerr << "--bench needs at least one --input\n";
+    return EXIT_FAILURE;
+  }
+
+  if (options.inputs.empty() && options.outputs.empty()) {
+    auto const device = Select("DeckLinks", deckLinks);
+    auto const mode =
+        Select("Modes", DisplayModes(deckLinks[device].get()));
+    options.inputs.push_back({device, mode});
   }
 
 /*
@@ -366,7 +1076,7 @@ int main(int, char **) {
         auto supported = False;
         if (deckLinkInput->DoesSupportVideoMode(
                 bmdVideoConnectionUnspecified, mode->GetDisplayMode(),
-                bmdColourSpace, bmdNoVideoInputConversion,
+                pixelFormat, bmdNoVideoInputConversion,
                 bmdSupportedVideoModeDefault, nullptr, &supported) != S_OK) {
           return False;
         }
@@ -378,29 +1088,301 @@ int main(int, char **) {
   }
 */
 
-  if (deckLinkInput->EnableVideoInput(displayMode->GetDisplayMode(),
-                                      bmdColourSpace,
-                                      bmdVideoInputFlagDefault) != S_OK) {
-    std::cerr << "Could not enable video input\n";
-    std::terminate();
+  auto const cores = std::max(1u, std::thread::hardware_concurrency());
+
+  // An input to capture, which follows its device through removal and
+  // re-attachment
+  struct Binding {
+    std::int64_t deviceId;
+    BMDDisplayMode displayMode;
+    std::string name;
+    std::string modeName;
+    int core;
+    std::unique_ptr<Capture> capture;
+    std::chrono::steady_clock::time_point removedAt;
+  };
+
+  // Opened before any thread it traces starts, and closed after they stop
+  auto traceSession = std::optional<trace::Session>{};
+  if (!options.tracePath.empty()) {
+    traceSession.emplace(options.tracePath);
   }
 
-  auto callback = Callback{std::move(displayMode)};
+  // Shared by every input, and outlives them
+  auto workers = std::optional<WorkerPool>{};
+  if (options.deinterlace != DeinterlaceMode::Off) {
+    workers.emplace(options.deinterlaceThreads > 0
+                        ? options.deinterlaceThreads
+                        : static_cast<std::size_t>(cores));
+  }
 
-  if (deckLinkInput->SetCallback(&callback) != S_OK) {
-    std::cerr << "Could not set callback\n";
-    std::terminate();
+  // One library for every sender, unloaded only once they have all gone
+  auto const ndi = NdiLibrary{};
+  auto bindings = std::vector<Binding>{};
+  for (auto const &spec : options.inputs) {
+    if (spec.device >= deckLinks.size()) {
+      std::cerr << "There is no DeckLink " << spec.device << '\n';
+      std::terminate();
+    }
+    if (std::count_if(options.inputs.begin(), options.inputs.end(),
+                      [&](auto const &other) {
+                        return other.device == spec.device;
+                      }) > 1) {
+      std::cerr << "DeckLink " << spec.device << " is given more than once\n";
+      std::terminate();
+    }
+    auto const deckLink = deckLinks[spec.device].get();
+    auto const modes = DisplayModes(deckLink);
+    if (spec.mode >= modes.size()) {
+      std::cerr << "DeckLink " << spec.device << " has no mode " << spec.mode
+                << '\n';
+      std::terminate();
+    }
+    auto const displayMode = modes[spec.mode].get();
+
+    // Sub-devices on one card have distinct names, but two identical cards
+    // would not
+    auto name = Name(deckLink);
+    if (std::count_if(deckLinks.begin(), deckLinks.end(), [&](auto const &d) {
+          return Name(d.get()) == name;
+        }) > 1) {
+      name += " #" + std::to_string(spec.device);
+    }
+    std::cout << "Capturing " << name << " as " << Name(displayMode) << '\n';
+
+    auto const deviceId = DeviceId(deckLink);
+    if (deviceId == 0) {
+      std::cout << name << " has no persistent ID, it will not be recovered "
+                           "after removal\n";
+    }
+    auto const core =
+        options.pin ? static_cast<int>(bindings.size() % cores) : -1;
+    auto capture =
+        Capture::Open(ndi, workers ? &*workers : nullptr, deckLink,
+                      displayMode, name, core, options);
+    if (capture == nullptr) {
+      std::terminate();
+    }
+    bindings.push_back({deviceId, displayMode->GetDisplayMode(),
+                        std::move(name), Name(displayMode), core,
+                        std::move(capture), {}});
   }
 
-  if (deckLinkInput->StartStreams() != S_OK) {
-    std::cerr << "Could not start streams\n";
-    std::terminate();
+  auto playouts = std::vector<DeckLinkPtr<Playout>>{};
+  for (auto const &spec : options.outputs) {
+    if (spec.device >= deckLinks.size()) {
+      std::cerr << "There is no DeckLink " << spec.device << '\n';
+      std::terminate();
+    }
+    auto const deckLink = deckLinks[spec.device].get();
+    auto const modes = DisplayModes(deckLink);
+    if (spec.mode >= modes.size()) {
+      std::cerr << "DeckLink " << spec.device << " has no mode " << spec.mode
+                << '\n';
+      std::terminate();
+    }
+    auto const displayMode = modes[spec.mode].get();
+
+    auto name = Name(deckLink) + " #" + std::to_string(spec.device) + " out";
+    std::cout << "Playing " << spec.source << " out of " << name << " as "
+              << Name(displayMode) << '\n';
+    auto playout = Playout::Open(ndi, deckLink, displayMode, std::move(name),
+                                 spec.source, options);
+    if (playout == nullptr) {
+      std::terminate();
+    }
+    playouts.push_back(std::move(playout));
   }
 
+  // Guards each binding's capture coming and going against the metrics
+  // thread, which reads them. The capture path never takes it.
+  auto bindingsMutex = std::mutex{};
+
+  auto removed = [&](Binding &binding, Event const &event) {
+    std::cout << binding.name << ": removed\n";
+    binding.capture->stop();
+    binding.capture->printStats();
+    {
+      auto const lock = std::scoped_lock{bindingsMutex};
+      binding.capture.reset();
+    }
+    binding.removedAt = event.at;
+  };
+
+  auto arrived = [&](Binding &binding, Event const &event) {
+    auto const modes = DisplayModes(event.device.get());
+    auto const mode = std::find_if(modes.begin(), modes.end(), [&](auto &m) {
+      return m->GetDisplayMode() == binding.displayMode;
+    });
+    if (mode == modes.end()) {
+      std::cerr << binding.name << ": returned without its display mode\n";
+      return;
+    }
+    auto capture =
+        Capture::Open(ndi, workers ? &*workers : nullptr, event.device.get(),
+                      mode->get(), binding.name, binding.core, options,
+                      binding.removedAt);
+    if (capture == nullptr) {
+      std::cerr << binding.name << ": will try again when it next arrives\n";
+      return;
+    }
+    {
+      auto const lock = std::scoped_lock{bindingsMutex};
+      binding.capture = std::move(capture);
+    }
+    std::cout << binding.name << ": restarted "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - binding.removedAt)
+                     .count()
+              << "ms after removal\n";
+  };
+
+  auto metricsServer = std::optional<MetricsServer>{};
+  if (options.metricsPort != 0) {
+    metricsServer.emplace(options.metricsPort, [&] {
+      auto streams = std::vector<StreamMetrics>{};
+      {
+        auto const lock = std::scoped_lock{bindingsMutex};
+        for (auto const &binding : bindings) {
+          streams.push_back(binding.capture != nullptr
+                                ? binding.capture->metrics()
+                                : StreamMetrics{binding.name});
+        }
+      }
+      auto outputs = std::vector<OutputMetrics>{};
+      for (auto i = std::size_t{0}; i < playouts.size(); i++) {
+        outputs.push_back({options.outputs[i].source, playouts[i]->stats()});
+      }
+      return RenderMetrics(streams, outputs);
+    });
+  }
+
+  auto events = EventQueue{};
+  auto const signals = SignalHandler{events};
+  // Synthetic devices never come and go
+  auto discovery = std::optional<DeviceDiscovery>{};
+  if (options.fakeDevices == 0) {
+    discovery.emplace(events);
+  }
+
+  // With --bench, a warm-up and then the measured run, each ending in an
+  // event
+  auto benchTimer = std::jthread{};
+  if (options.bench.count() > 0) {
+    benchTimer = std::jthread{[&](std::stop_token stop) {
+      auto mutex = std::mutex{};
+      auto sleeper = std::condition_variable_any{};
+      auto sleep = [&](auto duration) {
+        auto lock = std::unique_lock{mutex};
+        sleeper.wait_for(lock, stop, duration, [] { return false; });
+        return !stop.stop_requested();
+      };
+      if (sleep(benchWarmup)) {
+        events.post({Event::BenchStart});
+        if (sleep(options.bench)) {
+          events.post({Event::BenchEnd});
+        }
+      }
+    }};
+  }
+  auto benchPoint = [&] {
+    auto point = BenchPoint{};
+    for (auto const &binding : bindings) {
+      point.streams.push_back(
+          binding.capture != nullptr
+              ? BenchSample{binding.capture->stats(),
+                            binding.capture->latency()[Stage::Total]}
+              : BenchSample{});
+    }
+    return point;
+  };
+  auto benchStart = std::optional<BenchPoint>{};
+  auto benchEnd = std::optional<BenchPoint>{};
+
   while (true) {
+    auto const event = events.wait();
+    if (event.type == Event::Shutdown) {
+      break;
+    }
+    if (event.type == Event::DumpStats) {
+      for (auto const &binding : bindings) {
+        if (binding.capture != nullptr) {
+          binding.capture->printStats();
+          binding.capture->printLatency();
+        }
+      }
+      for (auto i = std::size_t{0}; i < playouts.size(); i++) {
+        std::cout << "Output " << options.outputs[i].source << ": "
+                  << playouts[i]->stats() << '\n';
+      }
+      continue;
+    }
+    if (event.type == Event::BenchStart) {
+      std::cout << "Warmed up, measuring for " << options.bench.count()
+                << "s\n";
+      benchStart = benchPoint();
+      continue;
+    }
+    if (event.type == Event::BenchEnd) {
+      benchEnd = benchPoint();
+      break;
+    }
+    for (auto &binding : bindings) {
+      if (binding.deviceId == 0 || binding.deviceId != event.deviceId) {
+        continue;
+      }
+      if (event.type == Event::DeviceRemoved && binding.capture != nullptr) {
+        removed(binding, event);
+      } else if (event.type == Event::DeviceArrived &&
+                 binding.capture == nullptr) {
+        arrived(binding, event);
+      }
+    }
   }
 
-  if (deckLinkInput->StopStreams() != S_OK) {
-    return EXIT_FAILURE;
+  std::cout << "Shutting down\n";
+
+  for (auto &playout : playouts) {
+    playout->stop();
+  }
+  for (auto &binding : bindings) {
+    if (binding.capture != nullptr) {
+      binding.capture->stop();
+    }
+  }
+  for (auto const &binding : bindings) {
+    if (binding.capture != nullptr) {
+      binding.capture->printStats();
+      binding.capture->printLatency();
+    }
+  }
+  for (auto i = std::size_t{0}; i < playouts.size(); i++) {
+    std::cout << "Output " << options.outputs[i].source << ": "
+              << playouts[i]->stats() << '\n';
+  }
+
+  if (benchStart && benchEnd) {
+    auto names = std::vector<std::string>{};
+    auto modes = std::vector<std::string>{};
+    for (auto const &binding : bindings) {
+      names.push_back(binding.name);
+      modes.push_back(binding.modeName);
+    }
+    auto const report = MakeBenchReport(
+        names, modes,
+        PixelFormatName(options.tenBit ? bmdFormat10BitYUV : bmdFormat8BitYUV),
+        *benchStart, *benchEnd);
+    std::cout << report;
+    if (options.benchJson == "-") {
+      WriteJson(stdoutJson, report);
+      stdoutJson.flush();
+    } else if (!options.benchJson.empty()) {
+      auto file = std::ofstream{options.benchJson};
+      WriteJson(file, report);
+      if (!file) {
+        std::cerr << "Could not write " << options.benchJson << '\n';
+        return EXIT_FAILURE;
+      }
+    }
   }
 }
@@ -0,0 +1,470 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "counters.h"
+#include "decklink.h"
+#include "stages.h"
+
+#if defined(UNIX)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#elif defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+// One capture as the scrape found it
+struct StreamMetrics {
+  std::string name;
+  // False while the device is away, when nothing else is filled in
+  bool up = false;
+  StreamStats stats{};
+  StageLatency::Snapshot latency{};
+  int connections = 0;
+  bool onProgram = false;
+  bool onPreview = false;
+  BufferPoolStats captureBuffers{};
+  BufferPoolStats conversionBuffers{};
+  BufferPoolStats audioBuffers{};
+  // Fed alongside the stream's own sender, by name
+  std::vector<std::pair<std::string, SinkStats>> sinks{};
+};
+
+struct OutputMetrics {
+  std::string source;
+  PlayoutStats stats{};
+};
+
+// The Prometheus text exposition format, one family at a time
+class MetricsWriter {
+private:
+  std::ostringstream out;
+
+  static void label(std::ostream &os, std::string_view value) {
+    os << '"';
+    for (auto const c : value) {
+      switch (c) {
+      case '\\':
+        os << "\\\\";
+        break;
+      case '"':
+        os << "\\\"";
+        break;
+      case '\n':
+        os << "\\n";
+        break;
+      default:
+        os << c;
+      }
+    }
+    os << '"';
+  }
+
+public:
+  using Labels = std::vector<std::pair<std::string_view, std::string_view>>;
+
+  void family(std::string_view name, std::string_view type,
+              std::string_view help) {
+    out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' '
+        << type << '\n';
+  }
+
+  template <typename T>
+  void sample(std::string_view name, Labels const &labels, T value) {
+    out << name;
+    if (!labels.empty()) {
+      auto first = true;
+      for (auto const &[key, value] : labels) {
+        out << (first ? "{" : ",") << key << '=';
+        label(out, value);
+        first = false;
+      }
+      out << '}';
+    }
+    out << ' ' << value << '\n';
+  }
+
+  auto str() const { return out.str(); }
+};
+
+// Bucket bounds for the stage latencies, in nanoseconds
+inline constexpr auto latencyBuckets = std::array<std::uint64_t, 11>{
+    100'000,   250'000,    500'000,    1'000'000,  2'500'000,  5'000'000,
+    10'000'000, 25'000'000, 50'000'000, 100'000'000, 250'000'000,
+};
+
+inline auto RenderMetrics(std::vector<StreamMetrics> const &streams,
+                          std::vector<OutputMetrics> const &outputs)
+    -> std::string {
+  auto w = MetricsWriter{};
+  auto const each = [&](auto const &f) {
+    for (auto const &s : streams) {
+      if (s.up) {
+        f(s, MetricsWriter::Labels{{"stream", s.name}});
+      }
+    }
+  };
+
+  w.family("decklink_ndi_stream_up", "gauge",
+           "Whether the stream's device is present and capturing.");
+  for (auto const &s : streams) {
+    w.sample("decklink_ndi_stream_up", {{"stream", s.name}}, s.up ? 1 : 0);
+  }
+
+  w.family("decklink_ndi_frames_captured_total", "counter",
+           "Video frames delivered by the driver.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_frames_captured_total", l, s.stats.captured);
+  });
+  w.family("decklink_ndi_frames_sent_total", "counter",
+           "Video frames handed to NDI.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_frames_sent_total", l, s.stats.sent);
+  });
+  w.family("decklink_ndi_audio_packets_sent_total", "counter",
+           "Audio packets handed to NDI.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_audio_packets_sent_total", l, s.stats.audioSent);
+  });
+  w.family("decklink_ndi_audio_packets_dropped_total", "counter",
+           "Audio packets not sent for want of room in the queue.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_audio_packets_dropped_total", l,
+             s.stats.drops.audio);
+  });
+  w.family("decklink_ndi_audio_underruns_total", "counter",
+           "Video frames that arrived without audio.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_audio_underruns_total", l, s.stats.audioMissing);
+  });
+
+  w.family("decklink_ndi_frames_dropped_total", "counter",
+           "Video frames not sent, by cause.");
+  each([&](auto const &s, auto const &l) {
+    auto const dropped = [&](std::string_view cause, std::uint64_t n) {
+      auto labels = l;
+      labels.emplace_back("cause", cause);
+      w.sample("decklink_ndi_frames_dropped_total", labels, n);
+    };
+    dropped("overflow", s.stats.drops.overflows);
+    dropped("stale", s.stats.drops.stale);
+    dropped("timeout", s.stats.drops.timeouts);
+    dropped("halved", s.stats.drops.halved);
+    dropped("no_memory", s.stats.drops.noMemory);
+    dropped("driver_backlog", s.stats.flushed);
+    dropped("driver", s.stats.missed);
+    dropped("unwatched", s.stats.unwatched);
+    dropped("format_change", s.stats.formatChangeFramesLost);
+  });
+
+  auto const eachSink = [&](auto const &f) {
+    each([&](auto const &s, auto const &l) {
+      for (auto const &[name, stats] : s.sinks) {
+        auto labels = l;
+        labels.emplace_back("sink", name);
+        f(stats, labels);
+      }
+    });
+  };
+  w.family("decklink_ndi_sink_frames_sent_total", "counter",
+           "Video frames a sink sent.");
+  eachSink([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_sink_frames_sent_total", l, s.sent);
+  });
+  w.family("decklink_ndi_sink_frames_dropped_total", "counter",
+           "Video frames a sink did not send, by cause.");
+  eachSink([&](auto const &s, auto const &l) {
+    auto const dropped = [&](std::string_view cause, std::uint64_t n) {
+      auto labels = l;
+      labels.emplace_back("cause", cause);
+      w.sample("decklink_ndi_sink_frames_dropped_total", labels, n);
+    };
+    dropped("overflow", s.drops.overflows);
+    dropped("stale", s.drops.stale);
+    dropped("timeout", s.drops.timeouts);
+    dropped("halved", s.drops.halved);
+    dropped("no_memory", s.drops.noMemory);
+    dropped("unwatched", s.unwatched);
+  });
+  w.family("decklink_ndi_sink_queue_depth", "gauge",
+           "Frames waiting for a sink.");
+  eachSink([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_sink_queue_depth", l, s.queued);
+  });
+
+  w.family("decklink_ndi_format_changes_total", "counter",
+           "Input format changes detected.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_format_changes_total", l, s.stats.formatChanges);
+  });
+  w.family("decklink_ndi_queue_depth", "gauge",
+           "Frames waiting between capture and the sender.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_queue_depth", l, s.stats.queued);
+  });
+  w.family("decklink_ndi_cpu_seconds_total", "counter",
+           "CPU time of the stream's capture and sender threads.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_cpu_seconds_total", l,
+             static_cast<double>(s.stats.cpuTime) / 1e9);
+  });
+  w.family("decklink_ndi_clock_drift_ppm", "gauge",
+           "Card reference clock against the system clock.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_clock_drift_ppm", l, s.stats.clockDriftPpm);
+  });
+
+  w.family("decklink_ndi_stage_latency_seconds", "histogram",
+           "Time frames spend in each stage from the card to NDI.");
+  each([&](auto const &s, auto const &l) {
+    for (auto i = std::size_t{0}; i < stageCount; i++) {
+      auto const &h = s.latency.stages[i];
+      auto labels = l;
+      labels.emplace_back("stage", stageNames[i]);
+      auto bucket = labels;
+      bucket.emplace_back("le", "");
+      for (auto const bound : latencyBuckets) {
+        auto const le = std::to_string(static_cast<double>(bound) / 1e9);
+        bucket.back().second = le;
+        w.sample("decklink_ndi_stage_latency_seconds_bucket", bucket,
+                 h.atMost(bound));
+      }
+      bucket.back().second = "+Inf";
+      w.sample("decklink_ndi_stage_latency_seconds_bucket", bucket,
+               h.count());
+      w.sample("decklink_ndi_stage_latency_seconds_sum", labels,
+               static_cast<double>(h.sum()) / 1e9);
+      w.sample("decklink_ndi_stage_latency_seconds_count", labels, h.count());
+    }
+  });
+
+  w.family("decklink_ndi_connections", "gauge", "NDI receivers connected.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_connections", l, s.connections);
+  });
+  w.family("decklink_ndi_tally_program", "gauge",
+           "Whether a receiver has the stream on program.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_tally_program", l, s.onProgram ? 1 : 0);
+  });
+  w.family("decklink_ndi_tally_preview", "gauge",
+           "Whether a receiver has the stream on preview.");
+  each([&](auto const &s, auto const &l) {
+    w.sample("decklink_ndi_tally_preview", l, s.onPreview ? 1 : 0);
+  });
+
+  // Every pool metric is labelled by which of the stream's pools it is
+  auto const pools = [&](std::string_view name, std::string_view type,
+                         std::string_view help, auto field) {
+    w.family(name, type, help);
+    each([&](auto const &s, auto const &l) {
+      for (auto const &[pool, stats] :
+           {std::pair{"capture", &s.captureBuffers},
+            std::pair{"conversion", &s.conversionBuffers},
+            std::pair{"audio", &s.audioBuffers}}) {
+        auto labels = l;
+        labels.emplace_back("pool", pool);
+        w.sample(name, labels, stats->*field);
+      }
+    });
+  };
+  pools("decklink_ndi_buffer_bytes", "gauge", "Size of each pooled buffer.",
+        &BufferPoolStats::bufferSize);
+  pools("decklink_ndi_buffer_allocations_total", "counter",
+        "Buffers mapped, up front or on a miss.",
+        &BufferPoolStats::allocations);
+  pools("decklink_ndi_buffer_misses_total", "counter",
+        "Acquires that found the pool empty.", &BufferPoolStats::misses);
+  pools("decklink_ndi_buffers_outstanding", "gauge", "Buffers in use.",
+        &BufferPoolStats::outstanding);
+  pools("decklink_ndi_buffers_idle", "gauge", "Buffers waiting in the pool.",
+        &BufferPoolStats::idle);
+  pools("decklink_ndi_buffers_high_water_mark", "gauge",
+        "Most buffers in use at once.", &BufferPoolStats::highWaterMark);
+
+  auto const output = [&](std::string_view name, std::string_view help,
+                          std::string_view type, auto field) {
+    w.family(name, type, help);
+    for (auto const &o : outputs) {
+      w.sample(name, {{"source", o.source}}, o.stats.*field);
+    }
+  };
+  if (!outputs.empty()) {
+    output("decklink_ndi_output_frames_scheduled_total",
+           "Frames scheduled for playout.", "counter",
+           &PlayoutStats::scheduled);
+    output("decklink_ndi_output_frames_copied_total",
+           "Frames copied to suit DeckLink.", "counter",
+           &PlayoutStats::copied);
+    output("decklink_ndi_output_frames_blank_total",
+           "Blank frames for want of a matching source.", "counter",
+           &PlayoutStats::blank);
+    output("decklink_ndi_output_frames_late_total",
+           "Frames displayed late.", "counter", &PlayoutStats::late);
+    output("decklink_ndi_output_frames_dropped_total", "Frames dropped.",
+           "counter", &PlayoutStats::dropped);
+    output("decklink_ndi_output_buffered_frames",
+           "Frames scheduled ahead of playout.", "gauge",
+           &PlayoutStats::depth);
+  }
+  return w.str();
+}
+
+// Serves whatever render returns at /metrics on the loopback interface, for
+// Prometheus to scrape. Requests are answered one at a time on a thread of
+// its own, so a scrape never runs on the capture path.
+class MetricsServer {
+private:
+#if defined(UNIX)
+  using Socket = int;
+  static constexpr auto invalidSocket = -1;
+  static void Close(Socket s) { close(s); }
+#elif defined(WIN32)
+  using Socket = SOCKET;
+  static constexpr auto invalidSocket = INVALID_SOCKET;
+  static void Close(Socket s) { closesocket(s); }
+#endif
+
+  std::function<std::string()> render;
+  Socket listener = invalidSocket;
+  std::jthread thread;
+
+  static void SendAll(Socket s, std::string_view data) {
+    while (!data.empty()) {
+      auto const n =
+          send(s, data.data(), static_cast<int>(data.size()), 0);
+      if (n <= 0) {
+        return;
+      }
+      data.remove_prefix(static_cast<std::size_t>(n));
+    }
+  }
+
+  // Reads no further than the request line, the rest is of no interest
+  void serve(Socket client) {
+#if defined(UNIX)
+    auto timeout = timeval{1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#elif defined(WIN32)
+    auto timeout = DWORD{1000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO,
+               reinterpret_cast<char const *>(&timeout), sizeof(timeout));
+#endif
+    auto request = std::string{};
+    auto buffer = std::array<char, 1024>{};
+    while (request.find("\r\n") == request.npos && request.size() < 8192) {
+      auto const n = recv(client, buffer.data(), buffer.size(), 0);
+      if (n <= 0) {
+        return;
+      }
+      request.append(buffer.data(), static_cast<std::size_t>(n));
+    }
+    auto const line = std::string_view{request}.substr(0, request.find("\r\n"));
+
+    auto status = std::string_view{"200 OK"};
+    auto body = std::string{};
+    if (line.starts_with("GET /metrics ") || line.starts_with("GET / ")) {
+      body = render();
+    } else if (line.starts_with("GET ")) {
+      status = "404 Not Found";
+      body = "Try /metrics\n";
+    } else {
+      status = "405 Method Not Allowed";
+    }
+    auto response = std::ostringstream{};
+    response << "HTTP/1.1 " << status
+             << "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8"
+             << "\r\nContent-Length: " << body.size()
+             << "\r\nConnection: close\r\n\r\n"
+             << body;
+    SendAll(client, response.str());
+  }
+
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested()) {
+      // Wake now and then to notice being stopped
+#if defined(UNIX)
+      auto fd = pollfd{listener, POLLIN, 0};
+      if (poll(&fd, 1, 250) <= 0) {
+        continue;
+      }
+#elif defined(WIN32)
+      auto fd = WSAPOLLFD{listener, POLLRDNORM, 0};
+      if (WSAPoll(&fd, 1, 250) <= 0) {
+        continue;
+      }
+#endif
+      auto const client = accept(listener, nullptr, nullptr);
+      if (client == invalidSocket) {
+        continue;
+      }
+      serve(client);
+      Close(client);
+    }
+  }
+
+public:
+  MetricsServer(std::uint16_t port, std::function<std::string()> render)
+      : render{std::move(render)} {
+#if defined(WIN32)
+    auto data = WSADATA{};
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+      std::cerr << "Could not initialise Winsock\n";
+      std::terminate();
+    }
+#endif
+    listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == invalidSocket) {
+      std::cerr << "Could not create the metrics socket\n";
+      std::terminate();
+    }
+    auto const yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+               reinterpret_cast<char const *>(&yes), sizeof(yes));
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, reinterpret_cast<sockaddr const *>(&address),
+             sizeof(address)) != 0 ||
+        listen(listener, 4) != 0) {
+      std::cerr << "Could not listen for metrics on port " << port << '\n';
+      std::terminate();
+    }
+    std::cout << "Serving metrics at http://127.0.0.1:" << port
+              << "/metrics\n";
+    thread = std::jthread{[this](std::stop_token stop) { run(stop); }};
+  }
+
+  MetricsServer(MetricsServer const &) = delete;
+  MetricsServer &operator=(MetricsServer const &) = delete;
+  MetricsServer(MetricsServer &&) = delete;
+  MetricsServer &operator=(MetricsServer &&) = delete;
+
+  ~MetricsServer() {
+    if (thread.joinable()) {
+      thread.request_stop();
+      thread.join();
+    }
+    Close(listener);
+#if defined(WIN32)
+    WSACleanup();
+#endif
+  }
+};
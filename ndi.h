@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <Processing.NDI.Lib.h>
+
+#include "decklink.h"
+
+#if defined(UNIX)
+#include <dlfcn.h>
+#elif defined(WIN32)
+#include <windows.h>
+#endif
+
+// The NDI runtime, loaded dynamically as the NDI licence requires
+class NdiLibrary {
+private:
+#if defined(UNIX)
+  void *
+#elif defined(WIN32)
+  HMODULE
+#endif
+      dl;
+
+  NDIlib_v5 const *lib;
+
+public:
+  NdiLibrary() {
+#if defined(__APPLE__) && defined(__MACH__)
+    auto dir = std::string{"/usr/local/lib"};
+#else
+    auto const redist = std::getenv(NDILIB_REDIST_FOLDER);
+    auto dir = std::string{redist != nullptr ? redist : "."};
+#endif
+    auto path = dir + "/" + NDILIB_LIBRARY_NAME;
+
+#if defined(UNIX)
+    dl = dlopen(path.c_str(), RTLD_LOCAL | RTLD_NOW);
+#elif defined(WIN32)
+    dl = LoadLibraryA(path.c_str());
+#endif
+    if (!dl) {
+      std::cerr << "Can't find NDI lib, please get it from " << NDILIB_REDIST_URL << '\n';
+      std::terminate();
+    }
+    lib = reinterpret_cast<decltype(&NDIlib_v5_load)>(
+#if defined(UNIX)
+        dlsym
+#elif defined(WIN32)
+        GetProcAddress
+#endif
+        (dl, "NDIlib_v5_load"))();
+    if (lib == nullptr) {
+      std::cerr << "Can't find NDI symbol\n";
+      std::terminate();
+    }
+
+    if (!lib->initialize()) {
+      std::cerr << "NDI is not supported on this CPU\n";
+      std::terminate();
+    }
+  }
+
+  NdiLibrary(NdiLibrary const &) = delete;
+  NdiLibrary &operator=(NdiLibrary const &) = delete;
+  NdiLibrary(NdiLibrary &&) = delete;
+  NdiLibrary &operator=(NdiLibrary &&) = delete;
+
+  ~NdiLibrary() {
+    lib->destroy();
+#if defined(UNIX)
+    dlclose(dl);
+#elif defined(WIN32)
+    FreeLibrary(dl);
+#endif
+  }
+
+  auto operator->() const { return lib; }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Processing.NDI.Lib.h>
+
+#include "decklink.h"
+#include "ndi.h"
+
+// Lends a frame from an NDI frame sync to DeckLink without copying it. The
+// frame goes back to the frame sync once DeckLink lets go of its last
+// reference, after the frame has been played out. The frame sync must
+// outlive every frame it lends.
+class NdiVideoFrame : public ComObject<IDeckLinkVideoFrame> {
+private:
+  NdiLibrary const &ndi;
+  NDIlib_framesync_instance_t framesync;
+  NDIlib_video_frame_v2_t frame;
+
+protected:
+  ~NdiVideoFrame() override { ndi->framesync_free_video(framesync, &frame); }
+
+public:
+  NdiVideoFrame(NdiLibrary const &ndi, NDIlib_framesync_instance_t framesync,
+                NDIlib_video_frame_v2_t const &frame)
+      : ndi{ndi}, framesync{framesync}, frame{frame} {}
+
+  // Whether DeckLink can play the frame as it is, as bmdFormat8BitYUV
+  static auto Lendable(NDIlib_video_frame_v2_t const &frame) -> bool {
+    return frame.p_data != nullptr &&
+           frame.FourCC == NDIlib_FourCC_type_UYVY &&
+           frame.line_stride_in_bytes == RowBytes(bmdFormat8BitYUV, frame.xres);
+  }
+
+  auto GetWidth() -> long override { return frame.xres; }
+  auto GetHeight() -> long override { return frame.yres; }
+  auto GetRowBytes() -> long override { return frame.line_stride_in_bytes; }
+  auto GetPixelFormat() -> BMDPixelFormat override { return bmdFormat8BitYUV; }
+  auto GetFlags() -> BMDFrameFlags override { return bmdFrameFlagDefault; }
+
+  auto GetBytes(void **buffer) -> HRESULT override {
+    *buffer = frame.p_data;
+    return S_OK;
+  }
+
+  auto GetTimecode(BMDTimecodeFormat, IDeckLinkTimecode **timecode)
+      -> HRESULT override {
+    *timecode = nullptr;
+    return S_FALSE;
+  }
+
+  auto GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary)
+      -> HRESULT override {
+    *ancillary = nullptr;
+    return S_FALSE;
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    if (IsIUnknown(iid) || SameIID(iid, IID_IDeckLinkVideoFrame)) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoFrame *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+};
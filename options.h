@@ -0,0 +1,326 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// What to do with an input nobody is watching
+enum class IdleMode {
+  Send,
+  Skip,
+  Pause,
+};
+
+// How to turn interlaced input into progressive frames, see deinterlace.h
+enum class DeinterlaceMode {
+  Off,
+  Bob,
+  Adaptive,
+};
+
+// What a sink does with frames it is too slow for, see backpressure.h
+enum class DropPolicy {
+  Newest,
+  Oldest,
+  Block,
+  Halve,
+};
+
+// The size of each input's proxy stream, either a fraction of the input or
+// fixed. Off when both are zero.
+struct ProxySize {
+  int divisor = 0;
+  long width = 0;
+  long height = 0;
+};
+
+// An input to capture, by index into the lists --list prints
+struct InputSpec {
+  std::size_t device;
+  std::size_t mode;
+};
+
+// An NDI source to play out, and where
+struct OutputSpec {
+  std::size_t device;
+  std::size_t mode;
+  std::string source;
+};
+
+struct Options {
+  bool hugePages = false;
+  std::size_t poolFrames = 8;
+  std::size_t depth = 4;
+  bool tenBit = false;
+  int audioChannels = 2;
+  int audioDepth = 32;
+  std::vector<InputSpec> inputs;
+  bool pin = false;
+  bool list = false;
+  IdleMode idle = IdleMode::Send;
+  std::vector<OutputSpec> outputs;
+  std::size_t outputLatency = 3;
+  std::size_t fakeDevices = 0;
+  std::chrono::microseconds fakeJitter{0};
+  double fakeDropPercent = 0;
+  std::chrono::seconds fakeFormatChange{0};
+  std::chrono::seconds bench{0};
+  std::string benchJson;
+  // Zero for no metrics endpoint
+  std::uint16_t metricsPort = 0;
+  std::string tracePath;
+  DeinterlaceMode deinterlace = DeinterlaceMode::Off;
+  // Zero for one per core
+  std::size_t deinterlaceThreads = 0;
+  ProxySize proxy;
+  DropPolicy dropPolicy = DropPolicy::Newest;
+  DropPolicy proxyDropPolicy = DropPolicy::Newest;
+  std::chrono::milliseconds blockTimeout{20};
+  // Zero to leave the driver's queue alone
+  std::size_t flushBacklog = 0;
+};
+
+[[noreturn]] inline void PrintUsage(char const *argv0) {
+  std::cerr << "Usage: " << argv0 << " [options]\n"
+            << "  --huge-pages        Back capture buffers with huge pages\n"
+            << "  --pool-frames N     Capture buffers to allocate up front "
+               "(default 8)\n"
+            << "  --depth N           Frames held between capture and NDI "
+               "(default 4, at least 2)\n"
+            << "  --10bit             Capture 10 bit YUV and send it as P216\n"
+            << "  --audio-channels N  Audio channels to capture, 0, 2, 8 or "
+               "16 (default 2)\n"
+            << "  --audio-depth N     Audio sample depth, 16 or 32 (default "
+               "32)\n"
+            << "  --input D[:M]       Capture device D in mode M (default 0), "
+               "repeat for more\n"
+            << "                      inputs, prompts for one if not given\n"
+            << "  --list              List devices and modes then exit\n"
+            << "  --pin               Pin each input's sender thread to its "
+               "own core\n"
+            << "  --idle skip|pause   With no NDI receivers, stop sending "
+               "frames, and with\n"
+            << "                      pause stop capturing them too\n"
+            << "  --output D[:M]=NAME Play NDI source NAME out of device D in "
+               "mode M, repeat\n"
+            << "                      for more outputs\n"
+            << "  --output-latency N  Frames to buffer ahead of playout "
+               "(default 3)\n"
+            << "  --fake N            Use N synthetic DeckLinks instead of "
+               "real ones\n"
+            << "  --fake-jitter US    Delay synthetic frames by up to US "
+               "microseconds\n"
+            << "  --fake-drop P       Drop P percent of synthetic frames\n"
+            << "  --fake-format-change S\n"
+            << "                      Change synthetic input format every S "
+               "seconds\n"
+            << "  --bench S           Run the inputs for S seconds, then "
+               "report throughput,\n"
+            << "                      CPU and latency and exit\n"
+            << "  --bench-json FILE   Also write the benchmark report to FILE "
+               "as JSON, - for\n"
+            << "                      stdout\n"
+            << "  --metrics PORT      Serve Prometheus metrics on "
+               "127.0.0.1:PORT\n"
+            << "  --trace FILE        Write a Chrome trace of every frame's "
+               "progress to FILE\n"
+            << "  --deinterlace bob|adaptive\n"
+            << "                      Send interlaced inputs as progressive "
+               "at the field rate\n"
+            << "  --deinterlace-threads N\n"
+            << "                      Threads to deinterlace on, shared by "
+               "every input\n"
+            << "                      (default one per core)\n"
+            << "  --proxy half|quarter|WxH\n"
+            << "                      Also send each input scaled down, as "
+               "\"NAME (proxy)\",\n"
+            << "                      while anyone receives it\n"
+            << "  --drop-policy newest|oldest|block|halve\n"
+            << "                      What each input's sender does with "
+               "frames it falls\n"
+            << "                      behind on (default newest)\n"
+            << "  --proxy-drop-policy newest|oldest|block|halve\n"
+            << "                      The same for the proxy (default "
+               "newest)\n"
+            << "  --block-timeout MS  How long block waits for room before "
+               "dropping\n"
+            << "                      (default 20)\n"
+            << "  --flush-backlog N   Flush the driver's queue once more "
+               "than N frames wait\n"
+            << "                      in it\n";
+  std::exit(EXIT_FAILURE);
+}
+
+inline auto ParseOptions(int argc, char **argv) -> Options {
+  auto options = Options{};
+  for (auto i = 1; i < argc; i++) {
+    auto const arg = std::string_view{argv[i]};
+    auto value = [&] {
+      if (i + 1 >= argc) {
+        PrintUsage(argv[0]);
+      }
+      return std::string_view{argv[++i]};
+    };
+    auto parse = [&](std::string_view s) {
+      auto n = std::size_t{0};
+      auto const [end, error] = std::from_chars(s.data(), s.data() + s.size(), n);
+      if (error != std::errc{} || end != s.data() + s.size()) {
+        PrintUsage(argv[0]);
+      }
+      return n;
+    };
+    auto number = [&] { return parse(value()); };
+    auto deviceAndMode =
+        [&](std::string_view s) -> std::pair<std::size_t, std::size_t> {
+      auto const colon = s.find(':');
+      return {parse(s.substr(0, colon)),
+              colon == s.npos ? 0 : parse(s.substr(colon + 1))};
+    };
+    if (arg == "--huge-pages") {
+      options.hugePages = true;
+    } else if (arg == "--pool-frames") {
+      options.poolFrames = number();
+    } else if (arg == "--10bit") {
+      options.tenBit = true;
+    } else if (arg == "--depth") {
+      options.depth = number();
+      if (options.depth < 2) {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--audio-channels") {
+      options.audioChannels = static_cast<int>(number());
+      if (options.audioChannels != 0 && options.audioChannels != 2 &&
+          options.audioChannels != 8 && options.audioChannels != 16) {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--audio-depth") {
+      options.audioDepth = static_cast<int>(number());
+      if (options.audioDepth != 16 && options.audioDepth != 32) {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--input") {
+      auto const [device, mode] = deviceAndMode(value());
+      options.inputs.push_back({device, mode});
+    } else if (arg == "--output") {
+      auto const s = value();
+      auto const equals = s.find('=');
+      if (equals == s.npos || equals + 1 == s.size()) {
+        PrintUsage(argv[0]);
+      }
+      auto const [device, mode] = deviceAndMode(s.substr(0, equals));
+      options.outputs.push_back(
+          {device, mode, std::string{s.substr(equals + 1)}});
+    } else if (arg == "--output-latency") {
+      options.outputLatency = number();
+      if (options.outputLatency < 1) {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--fake") {
+#if defined(WIN32)
+      std::cerr << "Synthetic DeckLinks are not available on Windows\n";
+      std::exit(EXIT_FAILURE);
+#endif
+      options.fakeDevices = number();
+    } else if (arg == "--fake-jitter") {
+      options.fakeJitter = std::chrono::microseconds{number()};
+    } else if (arg == "--fake-drop") {
+      auto const percent = number();
+      if (percent > 100) {
+        PrintUsage(argv[0]);
+      }
+      options.fakeDropPercent = static_cast<double>(percent);
+    } else if (arg == "--fake-format-change") {
+      options.fakeFormatChange = std::chrono::seconds{number()};
+    } else if (arg == "--bench") {
+      options.bench = std::chrono::seconds{number()};
+      if (options.bench.count() < 1) {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--bench-json") {
+      options.benchJson = value();
+    } else if (arg == "--metrics") {
+      auto const port = number();
+      if (port < 1 || port > 65535) {
+        PrintUsage(argv[0]);
+      }
+      options.metricsPort = static_cast<std::uint16_t>(port);
+    } else if (arg == "--trace") {
+      options.tracePath = value();
+    } else if (arg == "--deinterlace") {
+      auto const mode = value();
+      if (mode == "bob") {
+        options.deinterlace = DeinterlaceMode::Bob;
+      } else if (mode == "adaptive") {
+        options.deinterlace = DeinterlaceMode::Adaptive;
+      } else {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--deinterlace-threads") {
+      options.deinterlaceThreads = number();
+    } else if (arg == "--proxy") {
+      auto const size = value();
+      if (size == "half") {
+        options.proxy = {2, 0, 0};
+      } else if (size == "quarter") {
+        options.proxy = {4, 0, 0};
+      } else {
+        auto const x = size.find('x');
+        if (x == size.npos) {
+          PrintUsage(argv[0]);
+        }
+        auto const width = static_cast<long>(parse(size.substr(0, x)));
+        auto const height = static_cast<long>(parse(size.substr(x + 1)));
+        // Whole UYVY macropixels
+        if (width < 2 || width % 2 != 0 || height < 1) {
+          PrintUsage(argv[0]);
+        }
+        options.proxy = {0, width, height};
+      }
+    } else if (arg == "--drop-policy" || arg == "--proxy-drop-policy") {
+      auto const policy = value();
+      auto &target = arg == "--drop-policy" ? options.dropPolicy
+                                            : options.proxyDropPolicy;
+      if (policy == "newest") {
+        target = DropPolicy::Newest;
+      } else if (policy == "oldest") {
+        target = DropPolicy::Oldest;
+      } else if (policy == "block") {
+        target = DropPolicy::Block;
+      } else if (policy == "halve") {
+        target = DropPolicy::Halve;
+      } else {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--block-timeout") {
+      options.blockTimeout = std::chrono::milliseconds{number()};
+    } else if (arg == "--flush-backlog") {
+      options.flushBacklog = number();
+      if (options.flushBacklog < 1) {
+        PrintUsage(argv[0]);
+      }
+    } else if (arg == "--pin") {
+      options.pin = true;
+    } else if (arg == "--list") {
+      options.list = true;
+    } else if (arg == "--idle") {
+      auto const mode = value();
+      if (mode == "skip") {
+        options.idle = IdleMode::Skip;
+      } else if (mode == "pause") {
+        options.idle = IdleMode::Pause;
+      } else {
+        PrintUsage(argv[0]);
+      }
+    } else {
+      PrintUsage(argv[0]);
+    }
+  }
+  return options;
+}
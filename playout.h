@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <ztd/out_ptr.hpp>
+
+#include <Processing.NDI.Lib.h>
+
+#include "bgra.h"
+#include "buffer_pool.h"
+#include "counters.h"
+#include "decklink.h"
+#include "ndi.h"
+#include "ndi_frame.h"
+#include "options.h"
+
+// Plays an NDI source out of a DeckLink output. Each completed frame is
+// replaced by the NDI frame sync's current frame, so the card's output clock
+// sets the pace and the frame sync repeats or drops source frames to match
+// it. Source frames are played without copying unless their layout does not
+// suit DeckLink, when they are copied into frames from our own pool.
+//
+// Enough frames are kept scheduled ahead to hold latency at the target,
+// rising by a frame whenever one is late or dropped and falling back once
+// playout has been clean for a while.
+class Playout : public ComObject<IDeckLinkVideoOutputCallback> {
+private:
+  // Clean frames before buffering one fewer
+  static constexpr auto shrinkAfter = 300;
+  // Furthest above the target buffering may rise
+  static constexpr auto headroom = std::size_t{4};
+
+  NdiLibrary const &ndi;
+  std::string name;
+
+  DeckLinkPtr<IDeckLinkOutput> output;
+  DeckLinkPtr<DeckLinkAllocator> allocator;
+  NDIlib_recv_instance_t receiver = nullptr;
+  NDIlib_framesync_instance_t framesync = nullptr;
+
+  long width = 0;
+  long height = 0;
+  long rowBytes = 0;
+  BMDTimeValue frameDuration = 0;
+  BMDTimeScale timeScale = 0;
+  NDIlib_frame_format_type_e frameFormat = NDIlib_frame_format_type_progressive;
+
+  // Touched only from the driver's output thread once playback has started.
+  // Our own frames, for sources that cannot be played directly
+  std::vector<DeckLinkPtr<IDeckLinkMutableVideoFrame>> frames;
+  std::vector<IDeckLinkMutableVideoFrame *> idle;
+  BMDTimeValue nextTime = 0;
+  std::size_t target;
+  int clean = 0;
+  // The source as last seen, so a source that cannot be played is reported
+  // once each time it changes rather than every frame
+  int sourceWidth = 0;
+  int sourceHeight = 0;
+  NDIlib_FourCC_video_type_e sourceFourCC{};
+  bool warned = false;
+
+  std::atomic<std::size_t> depth;
+  PlayoutCounters counters;
+
+  bool enabled = false;
+  bool callbackSet = false;
+  bool playing = false;
+  std::atomic<bool> stopping = false;
+  std::mutex stoppedMutex;
+  std::condition_variable stoppedCondition;
+  bool stopped = false;
+
+  Playout(NdiLibrary const &ndi, std::string name, std::size_t target)
+      : ndi{ndi}, name{std::move(name)}, target{target}, depth{target} {}
+
+  auto start(IDeckLink *deckLink, IDeckLinkDisplayMode *displayMode,
+             std::string const &source, bool hugePages) -> bool {
+    if (deckLink->QueryInterface(IID_IDeckLinkOutput,
+                                 ztd::out_ptr::out_ptr(output)) != S_OK) {
+      std::cerr << name << ": could not get a DeckLink output\n";
+      return false;
+    }
+
+    width = displayMode->GetWidth();
+    height = displayMode->GetHeight();
+    rowBytes = RowBytes(bmdFormat8BitYUV, width);
+    displayMode->GetFrameRate(&frameDuration, &timeScale);
+    if (displayMode->GetFieldDominance() != bmdProgressiveFrame) {
+      frameFormat = NDIlib_frame_format_type_interleaved;
+    }
+
+    auto recv_create = NDIlib_recv_create_v3_t{
+        NDIlib_source_t{source.c_str()}, NDIlib_recv_color_format_UYVY_BGRA,
+        NDIlib_recv_bandwidth_highest, true, name.c_str()};
+    receiver = ndi->recv_create_v3(&recv_create);
+    if (receiver == nullptr) {
+      std::cerr << name << ": could not create an NDI receiver\n";
+      return false;
+    }
+    framesync = ndi->framesync_create(receiver);
+    if (framesync == nullptr) {
+      std::cerr << name << ": could not create an NDI frame sync\n";
+      return false;
+    }
+
+    if (output->EnableVideoOutput(displayMode->GetDisplayMode(),
+                                  bmdVideoOutputFlagDefault) != S_OK) {
+      std::cerr << name << ": could not enable video output\n";
+      return false;
+    }
+    enabled = true;
+
+    auto const frameCount = target + headroom + 1;
+    allocator = DeckLinkPtr<DeckLinkAllocator>{new DeckLinkAllocator{
+        hugePages, static_cast<std::size_t>(rowBytes * height), frameCount}};
+    if (output->SetVideoOutputFrameMemoryAllocator(allocator.get()) != S_OK) {
+      std::cerr << name << ": could not set frame allocator\n";
+      return false;
+    }
+    for (auto i = std::size_t{0}; i < frameCount; i++) {
+      IDeckLinkMutableVideoFrame *frame = nullptr;
+      if (output->CreateVideoFrame(static_cast<int32_t>(width),
+                                   static_cast<int32_t>(height),
+                                   static_cast<int32_t>(rowBytes),
+                                   bmdFormat8BitYUV, bmdFrameFlagDefault,
+                                   &frame) != S_OK) {
+        std::cerr << name << ": could not create an output frame\n";
+        return false;
+      }
+      frames.push_back(MakeDeckLinkPtr(frame));
+      idle.push_back(frame);
+    }
+
+    if (output->SetScheduledFrameCompletionCallback(this) != S_OK) {
+      std::cerr << name << ": could not set output callback\n";
+      return false;
+    }
+    callbackSet = true;
+
+    for (auto i = std::size_t{0}; i < target; i++) {
+      if (!scheduleNext()) {
+        std::cerr << name << ": could not preroll\n";
+        return false;
+      }
+    }
+    if (output->StartScheduledPlayback(0, timeScale, 1.0) != S_OK) {
+      std::cerr << name << ": could not start playback\n";
+      return false;
+    }
+    playing = true;
+    return true;
+  }
+
+  // Schedules the frame sync's current frame, lent to DeckLink as it is where
+  // possible and otherwise copied into one of our own frames
+  auto scheduleNext() -> bool {
+    auto video = NDIlib_video_frame_v2_t{};
+    ndi->framesync_capture_video(framesync, &video, frameFormat);
+    if (video.p_data != nullptr &&
+        (video.xres != sourceWidth || video.yres != sourceHeight ||
+         video.FourCC != sourceFourCC)) {
+      sourceWidth = video.xres;
+      sourceHeight = video.yres;
+      sourceFourCC = video.FourCC;
+      warned = false;
+    }
+
+    auto lent = DeckLinkPtr<NdiVideoFrame>{};
+    IDeckLinkMutableVideoFrame *copy = nullptr;
+    IDeckLinkVideoFrame *frame;
+    if (video.xres == width && video.yres == height &&
+        NdiVideoFrame::Lendable(video)) {
+      lent = DeckLinkPtr<NdiVideoFrame>{
+          new NdiVideoFrame{ndi, framesync, video}};
+      frame = lent.get();
+    } else {
+      if (idle.empty()) {
+        ndi->framesync_free_video(framesync, &video);
+        return false;
+      }
+      copy = idle.back();
+      idle.pop_back();
+      fill(copy, video);
+      ndi->framesync_free_video(framesync, &video);
+      frame = copy;
+    }
+
+    if (output->ScheduleVideoFrame(frame, nextTime, frameDuration,
+                                   timeScale) != S_OK) {
+      if (copy != nullptr) {
+        idle.push_back(copy);
+      }
+      return false;
+    }
+    nextTime += frameDuration;
+    counters.scheduled.add();
+    return true;
+  }
+
+  // Copies a frame DeckLink cannot play directly, converting BGRA, or black
+  // if it cannot be played at all
+  void fill(IDeckLinkMutableVideoFrame *frame,
+            NDIlib_video_frame_v2_t const &video) {
+    void *data;
+    frame->GetBytes(&data);
+    auto const dst = static_cast<std::uint8_t *>(data);
+
+    auto const bgra = video.FourCC == NDIlib_FourCC_type_BGRA ||
+                      video.FourCC == NDIlib_FourCC_type_BGRX;
+    auto problem = static_cast<char const *>(nullptr);
+    if (video.p_data != nullptr) {
+      if (video.xres != width || video.yres != height) {
+        problem = "does not match the output";
+      } else if (video.FourCC != NDIlib_FourCC_type_UYVY && !bgra) {
+        problem = "is in a format that cannot be played";
+      }
+    }
+    if (video.p_data != nullptr && problem == nullptr) {
+      auto const &matrix = bgra::ForHeight(height);
+      for (auto y = 0l; y < height; y++) {
+        auto const src = video.p_data + y * video.line_stride_in_bytes;
+        if (bgra) {
+          bgra::RowToUyvy(src, dst + y * rowBytes, width, matrix);
+        } else {
+          std::memcpy(dst + y * rowBytes, src,
+                      static_cast<std::size_t>(width) * 2);
+        }
+      }
+      counters.copied.add();
+    } else {
+      if (problem != nullptr && !warned) {
+        warned = true;
+        auto const fourCC = static_cast<std::uint32_t>(video.FourCC);
+        std::cerr << name << ": source is " << video.xres << 'x' << video.yres
+                  << ' ' << static_cast<char>(fourCC)
+                  << static_cast<char>(fourCC >> 8)
+                  << static_cast<char>(fourCC >> 16)
+                  << static_cast<char>(fourCC >> 24) << ", which " << problem
+                  << ", playing black\n";
+      }
+      // UYVY black, two pixels at a time
+      auto const black = std::uint32_t{0x10801080};
+      for (auto y = 0l; y < height; y++) {
+        auto const row = dst + y * rowBytes;
+        for (auto x = 0l; x < width / 2; x++) {
+          std::memcpy(row + x * 4, &black, 4);
+        }
+      }
+      counters.blank.add();
+    }
+  }
+
+  auto ScheduledFrameCompleted(IDeckLinkVideoFrame *completedFrame,
+                               BMDOutputFrameCompletionResult result)
+      -> HRESULT override {
+    auto const frame = std::find_if(
+        frames.begin(), frames.end(), [&](auto const &f) {
+          return static_cast<IDeckLinkVideoFrame *>(f.get()) == completedFrame;
+        });
+    if (frame != frames.end()) {
+      idle.push_back(frame->get());
+    }
+    if (stopping.load(std::memory_order_acquire)) {
+      return S_OK;
+    }
+
+    auto current = depth.load(std::memory_order_relaxed);
+    switch (result) {
+    case bmdOutputFrameDisplayedLate:
+    case bmdOutputFrameDropped:
+      // The schedule has fallen behind the output, skip ahead a frame
+      (result == bmdOutputFrameDropped ? counters.dropped : counters.late)
+          .add();
+      nextTime += frameDuration;
+      clean = 0;
+      if (current < target + headroom) {
+        current++;
+        std::cout << name << ": buffering " << current << " frames\n";
+      }
+      break;
+    case bmdOutputFrameCompleted:
+      if (++clean >= shrinkAfter && current > target) {
+        clean = 0;
+        current--;
+        std::cout << name << ": buffering " << current << " frames\n";
+      }
+      break;
+    default:
+      break;
+    }
+    depth.store(current, std::memory_order_relaxed);
+
+    auto buffered = std::uint32_t{0};
+    output->GetBufferedVideoFrameCount(&buffered);
+    for (; buffered < current; buffered++) {
+      if (!scheduleNext()) {
+        break;
+      }
+    }
+    return S_OK;
+  }
+
+  auto ScheduledPlaybackHasStopped() -> HRESULT override {
+    {
+      auto const lock = std::scoped_lock{stoppedMutex};
+      stopped = true;
+    }
+    stoppedCondition.notify_all();
+    return S_OK;
+  }
+
+public:
+  // Null if playout could not be started, the reason having been logged
+  static auto Open(NdiLibrary const &ndi, IDeckLink *deckLink,
+                   IDeckLinkDisplayMode *displayMode, std::string name,
+                   std::string const &source, Options const &options)
+      -> DeckLinkPtr<Playout> {
+    auto playout = DeckLinkPtr<Playout>{
+        new Playout{ndi, std::move(name), options.outputLatency}};
+    if (!playout->start(deckLink, displayMode, source, options.hugePages)) {
+      // The driver may hold a reference until the callback is cleared
+      playout->stop();
+      return nullptr;
+    }
+    return playout;
+  }
+
+  Playout(Playout const &) = delete;
+  Playout &operator=(Playout const &) = delete;
+  Playout(Playout &&) = delete;
+  Playout &operator=(Playout &&) = delete;
+
+protected:
+  ~Playout() override {
+    stop();
+    if (framesync != nullptr) {
+      ndi->framesync_destroy(framesync);
+    }
+    if (receiver != nullptr) {
+      ndi->recv_destroy(receiver);
+    }
+  }
+
+public:
+  // Undoes as much of start() as succeeded
+  void stop() {
+    stopping.store(true, std::memory_order_release);
+    if (playing) {
+      playing = false;
+      output->StopScheduledPlayback(0, nullptr, timeScale);
+      auto lock = std::unique_lock{stoppedMutex};
+      stoppedCondition.wait_for(lock, std::chrono::seconds{1},
+                                [&] { return stopped; });
+    }
+    if (callbackSet) {
+      callbackSet = false;
+      output->SetScheduledFrameCompletionCallback(nullptr);
+    }
+    if (enabled) {
+      enabled = false;
+      output->DisableVideoOutput();
+    }
+  }
+
+  auto stats() const -> PlayoutStats {
+    return {counters.scheduled.load(), counters.copied.load(),
+            counters.blank.load(), counters.late.load(),
+            counters.dropped.load(), depth.load(std::memory_order_relaxed)};
+  }
+
+  auto QueryInterface(REFIID iid, LPVOID *ppv) -> HRESULT override {
+    if (IsIUnknown(iid) || SameIID(iid, IID_IDeckLinkVideoOutputCallback)) {
+      AddRef();
+      *ppv = static_cast<IDeckLinkVideoOutputCallback *>(this);
+      return S_OK;
+    }
+    *ppv = nullptr;
+    return E_NOINTERFACE;
+  }
+};
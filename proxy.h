@@ -0,0 +1,173 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <Processing.NDI.Lib.h>
+
+#include "backpressure.h"
+#include "buffer_pool.h"
+#include "counters.h"
+#include "frame_descriptor.h"
+#include "frame_ring.h"
+#include "ndi.h"
+#include "options.h"
+#include "scaler.h"
+#include "sink.h"
+#include "trace.h"
+
+// Sends an input scaled down as a second NDI source, "NAME (proxy)". It scales
+// straight from the captured frame, so it never waits on the full size
+// sender's conversions, and only while someone is receiving it.
+class ProxySink final : public FrameSink {
+private:
+  NdiLibrary const &ndi;
+  std::string sinkName;
+  NDIlib_send_instance_t sender;
+  Scaler scaler;
+  FrameRing frames;
+  Backpressure backpressure;
+  SinkCounters counters;
+
+  // Only touched by the sink's thread
+  bool watched = false;
+  std::chrono::steady_clock::time_point checkedAt;
+
+  std::jthread thread;
+
+  ProxySink(NdiLibrary const &ndi, std::string name,
+            NDIlib_send_instance_t sender, Options const &options)
+      : ndi{ndi}, sinkName{std::move(name)}, sender{sender},
+        scaler{options.proxy, options.hugePages},
+        frames{options.depth,
+               Backpressure::Capacity(options.proxyDropPolicy, options.depth),
+               Backpressure::StaleAt(options.proxyDropPolicy, options.depth)},
+        backpressure{sinkName, options.proxyDropPolicy, options.blockTimeout} {
+    thread = std::jthread{[this](std::stop_token stop) { run(stop); }};
+  }
+
+  // Whether anyone is receiving, asking NDI every so often
+  auto receiving() -> bool {
+    auto const now = std::chrono::steady_clock::now();
+    if (now - checkedAt >= std::chrono::milliseconds{250}) {
+      checkedAt = now;
+      watched = ndi->send_get_no_connections(sender, 0) > 0;
+    }
+    return watched;
+  }
+
+  void run(std::stop_token stop) {
+    trace::NameThread(sinkName, "sender");
+    auto const wakeOnStop = std::stop_callback{stop, [&] { frames.wake(); }};
+    // NDI reads the scaled copy until the next send, never the captured frame
+    auto held = PooledBuffer{};
+    while (true) {
+      auto const generation = frames.generation();
+      while (auto const pending = frames.pending()) {
+        if (!receiving()) {
+          if (held != nullptr) {
+            ndi->send_send_video_async_v2(sender, nullptr);
+            held.reset();
+          }
+          counters.unwatched.add();
+        } else if (pending.stale) {
+          counters.drops.stale.add();
+        } else if (auto scaled = scale(pending)) {
+          held = std::move(scaled);
+          counters.sent.add();
+        } else {
+          counters.drops.noMemory.add();
+        }
+        frames.submit();
+        frames.flush();
+      }
+      if (stop.stop_requested()) {
+        break;
+      }
+      frames.wait(generation);
+    }
+    ndi->send_send_video_async_v2(sender, nullptr);
+    frames.flush();
+  }
+
+  // Sends the frame scaled down, returning the copy for NDI to read until the
+  // next send. Interlaced frames are scaled whole, so the proxy is always
+  // progressive at the input's frame rate.
+  auto scale(FrameRing::Pending const &pending) -> PooledBuffer {
+    auto scope = trace::Scope{"proxy"};
+    scope.setFrame(pending.frameTimecode);
+    void *data;
+    pending.frame->GetBytes(&data);
+    auto const &descriptor = *pending.descriptor;
+    auto scaled = scaler.run(descriptor, data);
+    if (scaled == nullptr) {
+      return scaled;
+    }
+    auto const [width, height] = scaler.size(descriptor);
+    auto ndi_frame = NDIlib_video_frame_v2_t(
+        static_cast<int>(width), static_cast<int>(height),
+        NDIlib_FourCC_type_UYVY, descriptor.frameRateN, descriptor.frameRateD,
+        0.0f, NDIlib_frame_format_type_progressive, pending.frameTimecode,
+        static_cast<uint8_t *>(scaled.get()), static_cast<int>(width * 2));
+    ndi->send_send_video_async_v2(sender, &ndi_frame);
+    return scaled;
+  }
+
+public:
+  // Null if the NDI sender could not be created, the reason having been
+  // logged
+  static auto Open(NdiLibrary const &ndi, std::string const &name,
+                   Options const &options) -> std::unique_ptr<ProxySink> {
+    auto proxyName = name + " (proxy)";
+    auto send_create =
+        NDIlib_send_create_t{proxyName.c_str(), nullptr, false, false};
+    auto const sender = ndi->send_create(&send_create);
+    if (sender == nullptr) {
+      std::cerr << "Error creating NDI proxy sender\n";
+      return nullptr;
+    }
+    return std::unique_ptr<ProxySink>{
+        new ProxySink{ndi, std::move(proxyName), sender, options}};
+  }
+
+  ProxySink(ProxySink const &) = delete;
+  ProxySink &operator=(ProxySink const &) = delete;
+  ProxySink(ProxySink &&) = delete;
+  ProxySink &operator=(ProxySink &&) = delete;
+
+  ~ProxySink() override {
+    drain();
+    ndi->send_destroy(sender);
+  }
+
+  void offer(FrameHandle const &frame, FrameDescriptor const *descriptor,
+             std::int64_t timecode,
+             std::chrono::steady_clock::time_point arrivedAt) override {
+    backpressure.push(frames, counters.drops, frame, {}, descriptor, timecode,
+                      0, arrivedAt);
+  }
+
+  auto receivers() const -> int override {
+    return ndi->send_get_no_connections(sender, 0);
+  }
+
+  void drain() override {
+    if (thread.joinable()) {
+      thread.request_stop();
+      thread.join();
+    }
+  }
+
+  auto name() const -> std::string const & override { return sinkName; }
+
+  auto stats() const -> SinkStats override {
+    return {counters.sent.load(), counters.unwatched.load(),
+            counters.drops.load(), frames.queued()};
+  }
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "cpu.h"
+#include "decklink.h"
+#include "deinterlace.h"
+#include "frame_descriptor.h"
+#include "options.h"
+
+// Downscales captured frames into small UYVY copies. Halving and quartering
+// average whole blocks of pixels, fixed sizes are bilinear.
+//
+// UYVY keeps two pixels' luma and their shared chroma in four bytes, so a
+// row scales as macropixels: averaging two of them averages the chroma
+// samples with each other and the four luma samples in pairs. v210 is reduced
+// to UYVY a row at a time on the way in.
+
+namespace scale {
+
+// Halves a UYVY row of 2 * outBytes bytes into outBytes
+using Halve = void (*)(std::uint8_t const *src, std::uint8_t *dst,
+                       long outBytes);
+
+// dst = a + (b - a) * weight / 64
+using Lerp = void (*)(std::uint8_t const *a, std::uint8_t const *b,
+                      std::uint8_t *dst, long n, int weight);
+
+inline void HalveScalar(std::uint8_t const *src, std::uint8_t *dst,
+                        long outBytes) {
+  auto const avg = [](int a, int b) {
+    return static_cast<std::uint8_t>((a + b + 1) >> 1);
+  };
+  for (auto x = 0l; x < outBytes; x += 4, src += 8, dst += 4) {
+    dst[0] = avg(src[0], src[4]);
+    dst[1] = avg(src[1], src[3]);
+    dst[2] = avg(src[2], src[6]);
+    dst[3] = avg(src[5], src[7]);
+  }
+}
+
+inline void LerpScalar(std::uint8_t const *a, std::uint8_t const *b,
+                       std::uint8_t *dst, long n, int weight) {
+  for (auto x = 0l; x < n; x++) {
+    dst[x] = static_cast<std::uint8_t>(
+        (a[x] * (64 - weight) + b[x] * weight + 32) >> 6);
+  }
+}
+
+#if defined(X86)
+TARGET("avx2")
+inline void HalveAvx2(std::uint8_t const *src, std::uint8_t *dst,
+                      long outBytes) {
+  // Each 16 byte lane is four macropixels. The first half of the shuffle
+  // gathers one of each pair to average, the second half the other.
+  auto const pairs = _mm256_setr_epi8(0, 1, 2, 5, 8, 9, 10, 13, 4, 3, 6, 7, 12,
+                                      11, 14, 15, 0, 1, 2, 5, 8, 9, 10, 13, 4,
+                                      3, 6, 7, 12, 11, 14, 15);
+  auto x = 0l;
+  for (; x + 16 <= outBytes; x += 16) {
+    auto const v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + 2 * x)),
+        pairs);
+    auto const averaged = _mm256_avg_epu8(v, _mm256_srli_si256(v, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                     _mm256_castsi256_si128(
+                         _mm256_permute4x64_epi64(averaged, 0b1000)));
+  }
+  HalveScalar(src + 2 * x, dst + x, outBytes - x);
+}
+
+// Interleaved pairs of bytes from a and b, each weighted and rounded to 16
+// bits
+TARGET("avx2")
+inline auto Weigh(__m256i pairs, __m256i weights) {
+  return _mm256_srli_epi16(_mm256_add_epi16(_mm256_maddubs_epi16(pairs, weights),
+                                            _mm256_set1_epi16(32)),
+                           6);
+}
+
+TARGET("avx2")
+inline void LerpAvx2(std::uint8_t const *a, std::uint8_t const *b,
+                     std::uint8_t *dst, long n, int weight) {
+  auto const weights = _mm256_set1_epi16(
+      static_cast<short>((weight << 8) | (64 - weight)));
+  auto x = 0l;
+  for (; x + 32 <= n; x += 32) {
+    auto const va = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + x));
+    auto const vb = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + x));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(dst + x),
+        _mm256_packus_epi16(Weigh(_mm256_unpacklo_epi8(va, vb), weights),
+                            Weigh(_mm256_unpackhi_epi8(va, vb), weights)));
+  }
+  LerpScalar(a + x, b + x, dst + x, n - x, weight);
+}
+#endif
+
+struct Kernels {
+  char const *name;
+  Halve halve;
+  Lerp lerp;
+};
+
+inline auto Best() -> Kernels {
+#if defined(X86)
+  if (CpuHasAvx2()) {
+    return {"avx2", HalveAvx2, LerpAvx2};
+  }
+#endif
+  return {"scalar", HalveScalar, LerpScalar};
+}
+
+inline Kernels const best = Best();
+
+// The width of a row halved, in whole macropixels
+constexpr auto Halved(long width) { return width / 4 * 2; }
+
+// Each 32 bit word of v210 holds three components already in UYVY order, of
+// which only the top 8 bits are kept
+inline void V210ToUyvy(std::uint8_t const *src, std::uint8_t *dst,
+                       long width) {
+  auto const components = width * 2;
+  for (auto i = 0l; i < components; i += 3, src += 4) {
+    auto word = std::uint32_t{};
+    std::memcpy(&word, src, sizeof(word));
+    for (auto j = 0l; j < 3 && i + j < components; j++) {
+      dst[i + j] = static_cast<std::uint8_t>(word >> (10 * j + 2));
+    }
+  }
+}
+
+} // namespace scale
+
+// Scales one stream's frames to its proxy size, from one thread at a time
+class Scaler {
+private:
+  ProxySize proxy;
+  BufferPool buffers;
+
+  // Scratch rows, each a source row wide in UYVY
+  std::vector<std::uint8_t> rows[4];
+  std::vector<std::uint8_t> blended;
+  std::vector<std::uint8_t> halved;
+
+  // Where to sample for each output column, for the bilinear scaler
+  struct Tap {
+    long index;
+    int weight;
+  };
+  FrameDescriptor const *tapsFor = nullptr;
+  std::vector<Tap> rowTaps;
+  std::vector<Tap> lumaTaps;
+  std::vector<Tap> chromaTaps;
+
+  // Row y of the frame in UYVY, converted into scratch row slot if need be
+  auto row(FrameDescriptor const &descriptor, std::uint8_t const *frame,
+           long y, int slot) -> std::uint8_t const * {
+    auto const line = frame + y * descriptor.rowBytes;
+    if (descriptor.pixelFormat != bmdFormat10BitYUV) {
+      return line;
+    }
+    scale::V210ToUyvy(line, rows[slot].data(), descriptor.width);
+    return rows[slot].data();
+  }
+
+  // Source positions in 1/64ths, centres aligned
+  static auto Taps(long from, long to) -> std::vector<Tap> {
+    auto taps = std::vector<Tap>(static_cast<std::size_t>(to));
+    for (auto x = 0l; x < to; x++) {
+      auto const position =
+          std::clamp((2 * x + 1) * from * 64 / (2 * to) - 32, 0l,
+                     (from - 1) * 64);
+      auto const index = std::min(position / 64, from - 2);
+      taps[static_cast<std::size_t>(x)] = {
+          std::max(index, 0l),
+          static_cast<int>(position - std::max(index, 0l) * 64)};
+    }
+    return taps;
+  }
+
+  void box(FrameDescriptor const &descriptor, std::uint8_t const *frame,
+           std::uint8_t *out, long width, long height) {
+    auto const factor = static_cast<long>(proxy.divisor);
+    auto const bytes = descriptor.width * 2;
+    for (auto y = 0l; y < height; y++) {
+      auto const first = y * factor;
+      deinterlace::best.interpolate8(
+          row(descriptor, frame, first, 0), row(descriptor, frame, first + 1, 1),
+          blended.data(), bytes);
+      if (factor == 4) {
+        deinterlace::best.interpolate8(row(descriptor, frame, first + 2, 2),
+                                       row(descriptor, frame, first + 3, 3),
+                                       halved.data(), bytes);
+        deinterlace::best.interpolate8(blended.data(), halved.data(),
+                                       blended.data(), bytes);
+        scale::best.halve(blended.data(), halved.data(),
+                          scale::Halved(descriptor.width) * 2);
+        scale::best.halve(halved.data(), out + y * width * 2, width * 2);
+      } else {
+        scale::best.halve(blended.data(), out + y * width * 2, width * 2);
+      }
+    }
+  }
+
+  void bilinear(FrameDescriptor const &descriptor, std::uint8_t const *frame,
+                std::uint8_t *out, long width, long height) {
+    if (tapsFor != &descriptor) {
+      tapsFor = &descriptor;
+      rowTaps = Taps(descriptor.height, height);
+      lumaTaps = Taps(descriptor.width, width);
+      chromaTaps = Taps(descriptor.width / 2, width / 2);
+    }
+    for (auto y = 0l; y < height; y++) {
+      auto const [index, weight] = rowTaps[static_cast<std::size_t>(y)];
+      scale::best.lerp(row(descriptor, frame, index, 0),
+                       row(descriptor, frame, index + 1, 1), blended.data(),
+                       descriptor.width * 2, weight);
+      auto const dst = out + y * width * 2;
+      auto const sample = [&](long at, Tap tap, int step) {
+        auto const a = blended[static_cast<std::size_t>(at)];
+        auto const b = blended[static_cast<std::size_t>(at + step)];
+        return static_cast<std::uint8_t>(
+            (a * (64 - tap.weight) + b * tap.weight + 32) >> 6);
+      };
+      for (auto x = 0l; x < width; x++) {
+        auto const tap = lumaTaps[static_cast<std::size_t>(x)];
+        dst[2 * x + 1] = sample(tap.index * 2 + 1, tap, 2);
+      }
+      for (auto x = 0l; x < width / 2; x++) {
+        auto const tap = chromaTaps[static_cast<std::size_t>(x)];
+        dst[4 * x] = sample(tap.index * 4, tap, 4);
+        dst[4 * x + 2] = sample(tap.index * 4 + 2, tap, 4);
+      }
+    }
+  }
+
+public:
+  Scaler(ProxySize proxy, bool hugePages) : proxy{proxy}, buffers{hugePages} {}
+
+  // The proxy's size for frames in this format
+  auto size(FrameDescriptor const &descriptor) const -> std::pair<long, long> {
+    switch (proxy.divisor) {
+    case 2:
+      return {scale::Halved(descriptor.width), descriptor.height / 2};
+    case 4:
+      return {scale::Halved(scale::Halved(descriptor.width)),
+              descriptor.height / 4};
+    default:
+      return {proxy.width, proxy.height};
+    }
+  }
+
+  // The frame as captured scaled to UYVY. Null for formats other than 8 and
+  // 10 bit YUV, or if there was no memory for it.
+  auto run(FrameDescriptor const &descriptor, void const *frame)
+      -> PooledBuffer {
+    if (descriptor.pixelFormat != bmdFormat8BitYUV &&
+        descriptor.pixelFormat != bmdFormat10BitYUV) {
+      return {};
+    }
+    auto const [width, height] = size(descriptor);
+    auto out = Acquire(buffers, static_cast<std::size_t>(width * height * 2));
+    if (out == nullptr || width < 2 || height < 1) {
+      return {};
+    }
+    auto const bytes = static_cast<std::size_t>(descriptor.width * 2);
+    for (auto &scratch : rows) {
+      scratch.resize(bytes);
+    }
+    blended.resize(bytes);
+    halved.resize(bytes);
+
+    auto const src = static_cast<std::uint8_t const *>(frame);
+    auto const dst = static_cast<std::uint8_t *>(out.get());
+    if (proxy.divisor != 0) {
+      box(descriptor, src, dst, width, height);
+    } else {
+      bilinear(descriptor, src, dst, width, height);
+    }
+    return out;
+  }
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "counters.h"
+#include "frame_descriptor.h"
+#include "frame_ring.h"
+
+// Something fed every captured frame alongside a stream's own NDI sender. A
+// sink takes its own reference to each frame and works on a thread of its
+// own, dropping frames it has no room for rather than holding up the capture
+// thread or the other sinks. The driver gets a frame back once every sink has
+// let go of it.
+class FrameSink {
+public:
+  virtual ~FrameSink() = default;
+
+  // Called on the capture thread, must not block
+  virtual void offer(FrameHandle const &frame,
+                     FrameDescriptor const *descriptor, std::int64_t timecode,
+                     std::chrono::steady_clock::time_point arrivedAt) = 0;
+
+  // Receivers that want the input kept running while the stream's own sender
+  // has none
+  virtual auto receivers() const -> int = 0;
+
+  // Lets go of every frame, call once the input has been stopped
+  virtual void drain() = 0;
+
+  virtual auto name() const -> std::string const & = 0;
+  virtual auto stats() const -> SinkStats = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "histogram.h"
+
+// The steps a frame goes through between the card and NDI letting go of it
+enum class Stage {
+  // Callback entry past the frame's hardware reference time, once mapped onto
+  // the system clock
+  Delivery,
+  // Callback entry to the frame being queued for the sender
+  Callback,
+  // Queued to the sender picking it up
+  Queue,
+  // Conversion for NDI, including moving lower field first frames down a
+  // line, nothing for formats sent as captured
+  Convert,
+  // Deinterlacing both fields, nothing without --deinterlace
+  Deinterlace,
+  // The async send call, both of them when deinterlacing
+  Submit,
+  // The send call returning to NDI handing the frame back at the next one
+  Held,
+  // Callback entry to the send call returning
+  Total,
+};
+
+inline constexpr auto stageCount = static_cast<std::size_t>(Stage::Total) + 1;
+
+inline constexpr char const *stageNames[stageCount] = {
+    "delivery", "callback", "queue", "convert",
+    "deinterlace", "submit", "held", "total",
+};
+
+// A histogram for each stage, in nanoseconds. Each stage is only ever recorded
+// by one thread, either the driver's or the sender's.
+class StageLatency {
+private:
+  std::array<Histogram, stageCount> histograms;
+
+public:
+  void record(Stage stage, std::chrono::nanoseconds duration) {
+    auto const ns = std::max<std::int64_t>(duration.count(), 0);
+    histograms[static_cast<std::size_t>(stage)].record(
+        static_cast<std::uint64_t>(ns));
+  }
+
+  struct Snapshot {
+    std::array<Histogram::Snapshot, stageCount> stages;
+
+    auto operator[](Stage stage) const -> Histogram::Snapshot const & {
+      return stages[static_cast<std::size_t>(stage)];
+    }
+
+    auto operator-(Snapshot const &earlier) const -> Snapshot {
+      auto result = Snapshot{};
+      for (auto i = std::size_t{0}; i < stageCount; i++) {
+        result.stages[i] = stages[i] - earlier.stages[i];
+      }
+      return result;
+    }
+  };
+
+  auto snapshot() const -> Snapshot {
+    auto result = Snapshot{};
+    for (auto i = std::size_t{0}; i < stageCount; i++) {
+      result.stages[i] = histograms[i].snapshot();
+    }
+    return result;
+  }
+};
+
+// p50/p99/max of each stage, in microseconds
+inline auto operator<<(std::ostream &os, StageLatency::Snapshot const &latency)
+    -> std::ostream & {
+  auto const us = [](std::uint64_t ns) { return ns / 1000; };
+  auto first = true;
+  for (auto i = std::size_t{0}; i < stageCount; i++) {
+    auto const &h = latency.stages[i];
+    os << (first ? "" : ", ") << stageNames[i] << ' ' << us(h.percentile(0.5))
+       << '/' << us(h.percentile(0.99)) << '/' << us(h.max());
+    first = false;
+  }
+  return os;
+}
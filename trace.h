@@ -0,0 +1,267 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "counters.h"
+
+// Spans of time on each thread, written as a Chrome trace for chrome://tracing
+// or ui.perfetto.dev. Each thread records into a ring of its own, which a
+// background thread drains to the file, so recording only takes a lock for a
+// thread's first event and never touches the disk. While no trace is being
+// written, recording is a single branch.
+namespace trace {
+
+// Set while a Session is open
+inline std::atomic<bool> enabled = false;
+
+struct Event {
+  char const *name;
+  // Nanoseconds since the session started
+  std::int64_t begin;
+  std::int64_t end;
+  // Timecode of the frame concerned, negative for none
+  std::int64_t frame;
+};
+
+// Written by its thread, drained by the flusher
+class Ring {
+private:
+  static constexpr auto capacity = std::size_t{1} << 14;
+
+  std::array<Event, capacity> events;
+  std::atomic<std::uint64_t> head = 0;
+  std::atomic<std::uint64_t> tail = 0;
+
+public:
+  int const tid;
+  // Full when the flusher fell behind
+  Counter lost;
+  // Guarded by the registry's mutex
+  std::string name;
+
+  explicit Ring(int tid) : tid{tid}, name{"thread " + std::to_string(tid)} {}
+
+  void push(Event const &event) {
+    auto const h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == capacity) {
+      lost.add();
+      return;
+    }
+    events[h % capacity] = event;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  template <typename F> void drain(F &&f) {
+    auto t = tail.load(std::memory_order_relaxed);
+    auto const h = head.load(std::memory_order_acquire);
+    for (; t != h; t++) {
+      f(events[t % capacity]);
+    }
+    tail.store(h, std::memory_order_release);
+  }
+};
+
+// Every thread's ring. Rings outlive their threads, so a device that comes
+// and goes leaves a few behind, but a thread never has to hand its ring back.
+class Registry {
+private:
+  std::vector<std::unique_ptr<Ring>> rings;
+
+public:
+  std::mutex mutex;
+  std::chrono::steady_clock::time_point origin =
+      std::chrono::steady_clock::now();
+
+  auto add() -> Ring * {
+    auto const lock = std::scoped_lock{mutex};
+    rings.push_back(
+        std::make_unique<Ring>(static_cast<int>(rings.size()) + 1));
+    return rings.back().get();
+  }
+
+  // Call with the mutex held
+  auto all() const -> std::vector<std::unique_ptr<Ring>> const & {
+    return rings;
+  }
+
+  // Rings are never removed, so these stay valid without the mutex
+  auto snapshot() -> std::vector<Ring *> {
+    auto const lock = std::scoped_lock{mutex};
+    auto result = std::vector<Ring *>{};
+    for (auto const &ring : rings) {
+      result.push_back(ring.get());
+    }
+    return result;
+  }
+};
+
+inline auto registry() -> Registry & {
+  static auto instance = Registry{};
+  return instance;
+}
+
+inline auto localRing() -> Ring & {
+  thread_local auto ring = registry().add();
+  return *ring;
+}
+
+inline auto Now(std::chrono::steady_clock::time_point at =
+                    std::chrono::steady_clock::now()) -> std::int64_t {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             at - registry().origin)
+      .count();
+}
+
+// A span that has already happened, such as a frame's wait in a queue
+inline void Span(char const *name, std::chrono::steady_clock::time_point begin,
+                 std::chrono::steady_clock::time_point end,
+                 std::int64_t frame = -1) {
+  if (enabled.load(std::memory_order_relaxed)) {
+    localRing().push({name, Now(begin), Now(end), frame});
+  }
+}
+
+// Labels the calling thread in the trace as name and then role, cheap enough
+// to call per frame
+inline void NameThread(std::string_view name, std::string_view role) {
+  if (enabled.load(std::memory_order_relaxed)) {
+    thread_local auto named = false;
+    if (!named) {
+      named = true;
+      auto &ring = localRing();
+      auto const lock = std::scoped_lock{registry().mutex};
+      ring.name = std::string{name} + ' ' + std::string{role};
+    }
+  }
+}
+
+// Records the time from construction to destruction
+class Scope {
+private:
+  char const *name;
+  std::int64_t begin = -1;
+  std::int64_t frame = -1;
+
+public:
+  explicit Scope(char const *name) : name{name} {
+    if (enabled.load(std::memory_order_relaxed)) {
+      begin = Now();
+    }
+  }
+
+  Scope(Scope const &) = delete;
+  Scope &operator=(Scope const &) = delete;
+
+  ~Scope() {
+    if (begin >= 0) {
+      localRing().push({name, begin, Now(), frame});
+    }
+  }
+
+  void setFrame(std::int64_t timecode) { frame = timecode; }
+};
+
+// Writes the trace to a file from when it is opened until it is destroyed.
+// Open it before starting the threads to be traced, only one may exist at a
+// time.
+class Session {
+private:
+  std::ofstream file;
+  std::string path;
+  bool first = true;
+  std::jthread flusher;
+
+  void write(Ring const &ring, Event const &event) {
+    file << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name
+         << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.tid
+         << ",\"ts\":" << static_cast<double>(event.begin) / 1000
+         << ",\"dur\":" << static_cast<double>(event.end - event.begin) / 1000;
+    if (event.frame >= 0) {
+      file << ",\"args\":{\"timecode\":" << event.frame << '}';
+    }
+    file << '}';
+    first = false;
+  }
+
+  void flush() {
+    for (auto const ring : registry().snapshot()) {
+      ring->drain([&](Event const &event) { write(*ring, event); });
+    }
+    file.flush();
+  }
+
+public:
+  explicit Session(std::string path) : file{path}, path{std::move(path)} {
+    if (!file) {
+      std::cerr << "Could not open " << this->path << " for the trace\n";
+      std::terminate();
+    }
+    file << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    enabled.store(true, std::memory_order_relaxed);
+    flusher = std::jthread{[this](std::stop_token stop) {
+      auto mutex = std::mutex{};
+      auto sleeper = std::condition_variable_any{};
+      while (!stop.stop_requested()) {
+        flush();
+        auto lock = std::unique_lock{mutex};
+        sleeper.wait_for(lock, stop, std::chrono::milliseconds{100},
+                         [] { return false; });
+      }
+    }};
+  }
+
+  Session(Session const &) = delete;
+  Session &operator=(Session const &) = delete;
+  Session(Session &&) = delete;
+  Session &operator=(Session &&) = delete;
+
+  ~Session() {
+    enabled.store(false, std::memory_order_relaxed);
+    flusher.request_stop();
+    flusher.join();
+    flush();
+
+    auto const lock = std::scoped_lock{registry().mutex};
+    auto lost = std::uint64_t{0};
+    for (auto const &ring : registry().all()) {
+      file << (first ? "\n" : ",\n")
+           << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+           << ring->tid << ",\"args\":{\"name\":\"";
+      for (auto const c : ring->name) {
+        if (c == '"' || c == '\\') {
+          file << '\\';
+        }
+        file << c;
+      }
+      file << "\"}}";
+      first = false;
+      lost += ring->lost.load();
+    }
+    file << "\n]}\n";
+    if (!file) {
+      std::cerr << "Could not write the trace to " << path << '\n';
+    } else {
+      std::cout << "Trace written to " << path;
+      if (lost > 0) {
+        std::cout << ", " << lost << " events lost with the writer behind";
+      }
+      std::cout << '\n';
+    }
+  }
+};
+
+} // namespace trace
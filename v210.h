@@ -0,0 +1,294 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cpu.h"
+#include "fields.h"
+
+// Unpacks v210 (10 bit 4:2:2, six pixels in four little endian words) into
+// P216 (16 bit 4:2:2, a luma plane followed by an interleaved chroma plane).
+//
+// Each word holds three 10 bit components, in the order Cb Y Cr Y ... across
+// a group of four words. The vector kernels split two groups into the first
+// (A), second (B) and third (C) field of every word, widen each to 16 bits
+// and then gather the samples into place.
+
+namespace v210 {
+
+using Row = void (*)(std::uint8_t const *src, std::uint16_t *y,
+                     std::uint16_t *uv, long width);
+
+inline void RowScalar(std::uint8_t const *src, std::uint16_t *y,
+                      std::uint16_t *uv, long width) {
+  for (auto x = 0l; x < width; x += 6, src += 16) {
+    std::uint16_t components[12];
+    for (auto i = 0; i < 4; i++) {
+      std::uint32_t word;
+      std::memcpy(&word, src + 4 * i, 4);
+      components[3 * i + 0] = static_cast<std::uint16_t>((word & 0x3FF) << 6);
+      components[3 * i + 1] =
+          static_cast<std::uint16_t>(((word >> 10) & 0x3FF) << 6);
+      components[3 * i + 2] =
+          static_cast<std::uint16_t>(((word >> 20) & 0x3FF) << 6);
+    }
+    auto const n = width - x < 6 ? width - x : 6;
+    for (auto i = 0; i < n; i++) {
+      *y++ = components[2 * i + 1];
+      *uv++ = components[2 * i];
+    }
+  }
+}
+
+enum Field { A, B, C };
+
+struct Sample {
+  Field field;
+  int index;
+};
+
+// Where each sample of two groups ends up once the fields have been packed
+// into eight 16 bit lanes each
+constexpr Sample luma[12] = {{B, 0}, {A, 1}, {C, 1}, {B, 2}, {A, 3}, {C, 3},
+                             {B, 4}, {A, 5}, {C, 5}, {B, 6}, {A, 7}, {C, 7}};
+constexpr Sample chroma[12] = {{A, 0}, {C, 0}, {B, 1}, {A, 2}, {C, 2}, {B, 3},
+                               {A, 4}, {C, 4}, {B, 5}, {A, 6}, {C, 6}, {B, 7}};
+
+// A byte shuffle taking samples first to first + 7 from one field, zeroing
+// every other lane
+constexpr auto Shuffle(Sample const (&order)[12], int first, Field field) {
+  auto mask = std::array<std::int8_t, 16>{};
+  for (auto i = 0; i < 8; i++) {
+    auto const j = first + i;
+    if (j < 12 && order[j].field == field) {
+      mask[2 * i] = static_cast<std::int8_t>(2 * order[j].index);
+      mask[2 * i + 1] = static_cast<std::int8_t>(2 * order[j].index + 1);
+    } else {
+      mask[2 * i] = -128;
+      mask[2 * i + 1] = -128;
+    }
+  }
+  return mask;
+}
+
+// A table lookup taking samples first to first + 7 from all three fields laid
+// out one after another
+constexpr auto Table(Sample const (&order)[12], int first) {
+  auto mask = std::array<std::uint8_t, 16>{};
+  for (auto i = 0; i < 8; i++) {
+    auto const j = first + i;
+    if (j < 12) {
+      auto const byte = 16 * order[j].field + 2 * order[j].index;
+      mask[2 * i] = static_cast<std::uint8_t>(byte);
+      mask[2 * i + 1] = static_cast<std::uint8_t>(byte + 1);
+    } else {
+      mask[2 * i] = 0xFF;
+      mask[2 * i + 1] = 0xFF;
+    }
+  }
+  return mask;
+}
+
+#if defined(X86)
+struct Shuffles {
+  std::array<std::int8_t, 16> a, b, c;
+};
+
+constexpr Shuffles shuffles[4] = {
+    {Shuffle(luma, 0, A), Shuffle(luma, 0, B), Shuffle(luma, 0, C)},
+    {Shuffle(luma, 8, A), Shuffle(luma, 8, B), Shuffle(luma, 8, C)},
+    {Shuffle(chroma, 0, A), Shuffle(chroma, 0, B), Shuffle(chroma, 0, C)},
+    {Shuffle(chroma, 8, A), Shuffle(chroma, 8, B), Shuffle(chroma, 8, C)},
+};
+
+// Each 32 bit lane of v0 then v1 reduced to one field, shifted up to 16 bits
+template <int Shift>
+TARGET("sse4.1")
+inline auto Field(__m128i v0, __m128i v1) {
+  auto const mask = _mm_set1_epi32(0x3FF);
+  return _mm_packus_epi32(
+      _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v0, Shift), mask), 6),
+      _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v1, Shift), mask), 6));
+}
+
+inline auto Load(std::array<std::int8_t, 16> const &mask) {
+  return _mm_loadu_si128(reinterpret_cast<__m128i const *>(mask.data()));
+}
+
+TARGET("sse4.1")
+inline auto Gather(__m128i a, __m128i b, __m128i c, Shuffles const &m) {
+  return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, Load(m.a)),
+                                   _mm_shuffle_epi8(b, Load(m.b))),
+                      _mm_shuffle_epi8(c, Load(m.c)));
+}
+
+TARGET("sse4.1")
+inline void RowSse41(std::uint8_t const *src, std::uint16_t *y,
+                     std::uint16_t *uv, long width) {
+  auto x = 0l;
+  for (; x + 12 <= width; x += 12, src += 32, y += 12, uv += 12) {
+    auto const v0 = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
+    auto const v1 =
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 16));
+
+    auto const a = Field<0>(v0, v1);
+    auto const b = Field<10>(v0, v1);
+    auto const c = Field<20>(v0, v1);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y),
+                     Gather(a, b, c, shuffles[0]));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(y + 8),
+                     Gather(a, b, c, shuffles[1]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(uv),
+                     Gather(a, b, c, shuffles[2]));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(uv + 8),
+                     Gather(a, b, c, shuffles[3]));
+  }
+  RowScalar(src, y, uv, width - x);
+}
+
+template <int Shift>
+TARGET("avx2")
+inline auto Field(__m256i v0, __m256i v1) {
+  auto const mask = _mm256_set1_epi32(0x3FF);
+  return _mm256_packus_epi32(
+      _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v0, Shift), mask),
+                        6),
+      _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v1, Shift), mask),
+                        6));
+}
+
+TARGET("avx2")
+inline auto Gather(__m256i a, __m256i b, __m256i c, Shuffles const &m) {
+  return _mm256_or_si256(
+      _mm256_or_si256(
+          _mm256_shuffle_epi8(a, _mm256_broadcastsi128_si256(Load(m.a))),
+          _mm256_shuffle_epi8(b, _mm256_broadcastsi128_si256(Load(m.b)))),
+      _mm256_shuffle_epi8(c, _mm256_broadcastsi128_si256(Load(m.c))));
+}
+
+// Writes the 12 samples of each lane, lo holding the first 8 and hi the rest
+TARGET("avx2")
+inline void Store(std::uint16_t *out, __m256i lo, __m256i hi) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                   _mm256_castsi256_si128(lo));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 8),
+                   _mm256_castsi256_si128(hi));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 12),
+                   _mm256_extracti128_si256(lo, 1));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 20),
+                   _mm256_extracti128_si256(hi, 1));
+}
+
+TARGET("avx2")
+inline void RowAvx2(std::uint8_t const *src, std::uint16_t *y,
+                    std::uint16_t *uv, long width) {
+  // Each 128 bit lane works on two consecutive groups, as in RowSse41
+  auto x = 0l;
+  for (; x + 24 <= width; x += 24, src += 64, y += 24, uv += 24) {
+    auto const group = [src](int i) {
+      return _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 16 * i));
+    };
+    auto const g0 = group(0);
+    auto const g1 = group(1);
+    auto const g2 = group(2);
+    auto const g3 = group(3);
+    auto const v0 = _mm256_inserti128_si256(_mm256_castsi128_si256(g0), g2, 1);
+    auto const v1 = _mm256_inserti128_si256(_mm256_castsi128_si256(g1), g3, 1);
+
+    auto const a = Field<0>(v0, v1);
+    auto const b = Field<10>(v0, v1);
+    auto const c = Field<20>(v0, v1);
+
+    Store(y, Gather(a, b, c, shuffles[0]), Gather(a, b, c, shuffles[1]));
+    Store(uv, Gather(a, b, c, shuffles[2]), Gather(a, b, c, shuffles[3]));
+  }
+  RowSse41(src, y, uv, width - x);
+}
+#endif
+
+#if defined(ARM64)
+constexpr std::array<std::uint8_t, 16> tables[4] = {
+    Table(luma, 0), Table(luma, 8), Table(chroma, 0), Table(chroma, 8)};
+
+inline void RowNeon(std::uint8_t const *src, std::uint16_t *y,
+                    std::uint16_t *uv, long width) {
+  auto const mask = vdupq_n_u32(0x3FF);
+  uint8x16_t indices[4];
+  for (auto i = 0; i < 4; i++) {
+    indices[i] = vld1q_u8(tables[i].data());
+  }
+
+  auto x = 0l;
+  for (; x + 12 <= width; x += 12, src += 32, y += 12, uv += 12) {
+    auto const v0 = vld1q_u32(reinterpret_cast<std::uint32_t const *>(src));
+    auto const v1 =
+        vld1q_u32(reinterpret_cast<std::uint32_t const *>(src + 16));
+
+    auto const a =
+        vcombine_u16(vmovn_u32(vshlq_n_u32(vandq_u32(v0, mask), 6)),
+                     vmovn_u32(vshlq_n_u32(vandq_u32(v1, mask), 6)));
+    auto const b = vcombine_u16(
+        vmovn_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(v0, 10), mask), 6)),
+        vmovn_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(v1, 10), mask), 6)));
+    auto const c = vcombine_u16(
+        vmovn_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(v0, 20), mask), 6)),
+        vmovn_u32(vshlq_n_u32(vandq_u32(vshrq_n_u32(v1, 20), mask), 6)));
+
+    auto const fields = uint8x16x3_t{
+        {vreinterpretq_u8_u16(a), vreinterpretq_u8_u16(b),
+         vreinterpretq_u8_u16(c)}};
+
+    vst1q_u16(y, vreinterpretq_u16_u8(vqtbl3q_u8(fields, indices[0])));
+    vst1_u16(y + 8, vget_low_u16(vreinterpretq_u16_u8(
+                        vqtbl3q_u8(fields, indices[1]))));
+    vst1q_u16(uv, vreinterpretq_u16_u8(vqtbl3q_u8(fields, indices[2])));
+    vst1_u16(uv + 8, vget_low_u16(vreinterpretq_u16_u8(
+                         vqtbl3q_u8(fields, indices[3]))));
+  }
+  RowScalar(src, y, uv, width - x);
+}
+#endif
+
+struct Kernel {
+  char const *name;
+  Row row;
+};
+
+// The kernels this CPU can run, best first
+inline auto Kernels() -> std::vector<Kernel> {
+  auto kernels = std::vector<Kernel>{};
+#if defined(X86)
+  if (CpuHasAvx2()) {
+    kernels.push_back({"avx2", RowAvx2});
+  }
+  if (CpuHasSse41()) {
+    kernels.push_back({"sse4.1", RowSse41});
+  }
+#elif defined(ARM64)
+  kernels.push_back({"neon", RowNeon});
+#endif
+  kernels.push_back({"scalar", RowScalar});
+  return kernels;
+}
+
+inline Row const BestRow = Kernels().front().row;
+
+constexpr auto RowBytes(long width) { return (width + 47) / 48 * 128; }
+
+// dst holds the luma plane followed by the chroma plane, both width samples
+// wide. shiftDown moves a lower field first frame down a line on the way, see
+// fields.h.
+inline void ToP216(std::uint8_t const *src, long srcRowBytes,
+                   std::uint16_t *dst, long width, long height,
+                   Row row = BestRow, bool shiftDown = false) {
+  auto const uv = dst + width * height;
+  for (auto i = 0l; i < height; i++) {
+    auto const from = shiftDown ? fields::ShiftedRow(i) : i;
+    row(src + from * srcRowBytes, dst + i * width, uv + i * width, width);
+  }
+}
+
+} // namespace v210
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads shared by every stream for work split into independent pieces.
+// Whoever hands work in does its share too, so a stream is never left waiting
+// on a pool busy with another stream's frame.
+class WorkerPool {
+private:
+  struct Job {
+    std::function<void(std::size_t)> const &task;
+    std::size_t count;
+    std::atomic<std::size_t> next = 0;
+    std::atomic<std::size_t> remaining;
+    // Workers inside work(), guarded by the mutex
+    std::size_t active = 0;
+
+    Job(std::function<void(std::size_t)> const &task, std::size_t count)
+        : task{task}, count{count}, remaining{count} {}
+  };
+
+  std::mutex mutex;
+  std::condition_variable_any wake;
+  std::condition_variable finished;
+  std::deque<Job *> jobs;
+  std::vector<std::jthread> threads;
+
+  static void work(Job &job) {
+    while (true) {
+      auto const i = job.next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= job.count) {
+        return;
+      }
+      job.task(i);
+      job.remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+
+  void run(std::stop_token stop) {
+    auto lock = std::unique_lock{mutex};
+    while (wake.wait(lock, stop, [&] { return !jobs.empty(); })) {
+      auto &job = *jobs.front();
+      if (job.next.load(std::memory_order_relaxed) >= job.count) {
+        // Handed out in full, those still running it will see it finished
+        jobs.pop_front();
+        continue;
+      }
+      job.active++;
+      lock.unlock();
+      work(job);
+      lock.lock();
+      job.active--;
+      finished.notify_all();
+    }
+  }
+
+public:
+  explicit WorkerPool(std::size_t count) {
+    for (auto i = std::size_t{0}; i < count; i++) {
+      threads.emplace_back([this](std::stop_token stop) { run(stop); });
+    }
+  }
+
+  WorkerPool(WorkerPool const &) = delete;
+  WorkerPool &operator=(WorkerPool const &) = delete;
+  WorkerPool(WorkerPool &&) = delete;
+  WorkerPool &operator=(WorkerPool &&) = delete;
+
+  ~WorkerPool() {
+    for (auto &thread : threads) {
+      thread.request_stop();
+    }
+  }
+
+  // Calls task with every index below count, spread over the pool and the
+  // calling thread, and returns once they have all finished
+  void parallelFor(std::size_t count,
+                   std::function<void(std::size_t)> const &task) {
+    auto job = Job{task, count};
+    {
+      auto const lock = std::scoped_lock{mutex};
+      jobs.push_back(&job);
+    }
+    wake.notify_all();
+    work(job);
+
+    auto lock = std::unique_lock{mutex};
+    finished.wait(lock, [&] {
+      return job.active == 0 &&
+             job.remaining.load(std::memory_order_acquire) == 0;
+    });
+    if (auto const it = std::find(jobs.begin(), jobs.end(), &job);
+        it != jobs.end()) {
+      jobs.erase(it);
+    }
+  }
+};